@@ -1,18 +1,45 @@
 #ifndef BLOOM_H
 #define BLOOM_H
 
-#include "record_storage.h"
+#include <zephyr/types.h>
 #include "exposure-notification.h"
 
+enum bloom_type {
+    BLOOM_TYPE_STANDARD,  // k bits spread over the whole filter
+    BLOOM_TYPE_BLOCKED,   // one bit in each 32-bit word of a single 32-byte block
+};
+
 typedef struct {
     uint8_t* data;
-    size_t size;
+    size_t size;          // size of data in bytes
+    uint32_t num_bits;    // amount of bits used, at most size * 8
+    uint8_t num_hashes;   // amount of bits set per entry
+    uint32_t count;       // amount of added entries
+    uint8_t type;         // see enum bloom_type
 } bloom_filter_t;
 
 /**
- * Initialize the bloom filter on basis of the already registerred records.
+ * Initialize an empty bloom filter. The amount of bits and hashes is chosen for the expected amount of entries and the
+ * target false positive rate.
+ *
+ * @param expected_count the amount of entries, which will be added
+ * @param false_positive_rate the target rate of false positives with expected_count entries, e.g. 0.01
+ *
+ * @return the bloom filter or NULL, if it could not be allocated
+ */
+bloom_filter_t* bloom_init(size_t expected_count, float false_positive_rate);
+
+/**
+ * Initialize an empty blocked bloom filter. All bits of an entry are in the same 32-byte block, one in each of its
+ * 32-bit words, so each add or lookup touches a single cache line. Needs some more bits than bloom_init for the same
+ * false positive rate.
+ *
+ * @param expected_count the amount of entries, which will be added
+ * @param false_positive_rate the target rate of false positives with expected_count entries, e.g. 0.01
+ *
+ * @return the bloom filter or NULL, if it could not be allocated
  */
-bloom_filter_t* bloom_init(size_t size);
+bloom_filter_t* bloom_init_blocked(size_t expected_count, float false_positive_rate);
 
 void bloom_destroy(bloom_filter_t* bloom);
 
@@ -22,4 +49,9 @@ void bloom_add_record(bloom_filter_t* bloom, ENIntervalIdentifier* rpi);
 // TODO lome: maybe only use RPI (should be sufficient)
 bool bloom_probably_has_record(bloom_filter_t* bloom, ENIntervalIdentifier* rpi);
 
-#endif
\ No newline at end of file
+/**
+ * Estimate the current false positive rate from the amount of added entries.
+ */
+float bloom_estimate_fpr(bloom_filter_t* bloom);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef DESKTOP_SYS_PRINTK_H
+#define DESKTOP_SYS_PRINTK_H
+
+#include <stdio.h>
+
+#define printk printf
+
+#endif
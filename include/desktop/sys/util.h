@@ -0,0 +1,7 @@
+#ifndef DESKTOP_SYS_UTIL_H
+#define DESKTOP_SYS_UTIL_H
+
+// the desktop kernel header has our utility macros
+#include <zephyr.h>
+
+#endif
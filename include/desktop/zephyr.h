@@ -0,0 +1,28 @@
+#ifndef DESKTOP_ZEPHYR_H
+#define DESKTOP_ZEPHYR_H
+
+/**
+ * Minimal replacement of the kernel header for compiling platform independent sources in the desktop environment.
+ */
+
+#include <stdlib.h>
+#include <zephyr/types.h>
+
+#define k_malloc malloc
+#define k_calloc calloc
+#define k_free free
+
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#define ROUND_UP(x, align) \
+    ((((unsigned long)(x) + ((unsigned long)(align)-1)) / (unsigned long)(align)) * (unsigned long)(align))
+
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef DESKTOP_ZEPHYR_TYPES_H
+#define DESKTOP_ZEPHYR_TYPES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define __packed __attribute__((__packed__))
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2020 Olaf Landsiedel
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ENCOUNTER_H
+#define ENCOUNTER_H
+
+#include <zephyr/types.h>
+#include <exposure-notification.h>
+#include "record_storage.h"
+
+/**
+ * ENCOUNTERS
+ *
+ * Sightings of the same rolling proximity identifier are aggregated in RAM and stored as a single record, as soon as
+ * the identifier was not seen for CONFIG_ENS_ENCOUNTER_TIMEOUT seconds (e.g. because it rotated), but at the latest
+ * CONFIG_ENS_ENCOUNTER_MAX_DURATION seconds after its first sighting. Later sightings start a new encounter.
+ * Not thread safe, all functions are meant to be called from the contact storage thread.
+ */
+typedef struct encounter {
+    ENIntervalIdentifier rolling_proximity_identifier;
+    associated_encrypted_metadata_t associated_encrypted_metadata;
+    uint32_t first_seen;
+    uint32_t last_seen;
+    int32_t rssi_sum;
+    uint16_t sightings;
+    int8_t rssi_max;
+} encounter_t;
+
+/**
+ * Add a sighting to the encounter of its rolling proximity identifier. If the table is full, the encounter seen least
+ * recently is stored to make room.
+ *
+ * @param record the received record, only its rpi, aem, rssi and timestamp are used
+ *
+ * @return 0 on success
+ */
+int encounter_add_sighting(const record_t* record);
+
+/**
+ * Store all encounters, which were not seen for CONFIG_ENS_ENCOUNTER_TIMEOUT seconds or were first seen
+ * CONFIG_ENS_ENCOUNTER_MAX_DURATION seconds ago. Needs to be called at least every CONFIG_ENS_ENCOUNTER_TIMEOUT
+ * seconds, so records are appended within RECORD_MAX_APPEND_DELAY of their timestamp.
+ *
+ * @param now current timestamp
+ *
+ * @return the amount of stored encounters
+ */
+int encounter_flush_expired(uint32_t now);
+
+/**
+ * Store all encounters.
+ *
+ * @return the amount of stored encounters
+ */
+int encounter_flush_all();
+
+#endif
@@ -0,0 +1,224 @@
+/* Written by hand from export.proto, following the output of protoc-c 1.4. Regenerate it with
+ * zephyr/generate_protobuf.sh, the full schema is checked against protoc in test_key_export_protobuf_schema. */
+
+#ifndef PROTOBUF_C_export_2eproto__INCLUDED
+#define PROTOBUF_C_export_2eproto__INCLUDED
+
+#include "protobuf-c.h"
+
+PROTOBUF_C__BEGIN_DECLS
+
+#if PROTOBUF_C_VERSION_NUMBER < 1003000
+# error This file was generated by a newer version of protoc-c which is incompatible with your libprotobuf-c headers. Please update your headers.
+#elif 1004000 < PROTOBUF_C_MIN_COMPILER_VERSION
+# error This file was generated by an older version of protoc-c which is incompatible with your libprotobuf-c headers. Please regenerate this file with a newer version of protoc-c.
+#endif
+
+
+typedef struct _TemporaryExposureKeyExport TemporaryExposureKeyExport;
+typedef struct _SignatureInfo SignatureInfo;
+typedef struct _TemporaryExposureKey TemporaryExposureKey;
+
+
+/* --- enums --- */
+
+/*
+ * Data type representing why this key was published.
+ */
+typedef enum _TemporaryExposureKey__ReportType {
+  TEMPORARY_EXPOSURE_KEY__REPORT_TYPE__UNKNOWN = 0,
+  TEMPORARY_EXPOSURE_KEY__REPORT_TYPE__CONFIRMED_TEST = 1,
+  TEMPORARY_EXPOSURE_KEY__REPORT_TYPE__CONFIRMED_CLINICAL_DIAGNOSIS = 2,
+  TEMPORARY_EXPOSURE_KEY__REPORT_TYPE__SELF_REPORT = 3,
+  TEMPORARY_EXPOSURE_KEY__REPORT_TYPE__RECURSIVE = 4,
+  TEMPORARY_EXPOSURE_KEY__REPORT_TYPE__REVOKED = 5
+    PROTOBUF_C__FORCE_ENUM_TO_BE_INT_SIZE(TEMPORARY_EXPOSURE_KEY__REPORT_TYPE)
+} TemporaryExposureKey__ReportType;
+
+/* --- messages --- */
+
+struct  _TemporaryExposureKeyExport
+{
+  ProtobufCMessage base;
+  /*
+   * Time window of keys in this batch based on arrival to server, in UTC seconds.
+   */
+  protobuf_c_boolean has_start_timestamp;
+  uint64_t start_timestamp;
+  protobuf_c_boolean has_end_timestamp;
+  uint64_t end_timestamp;
+  /*
+   * Region for which these keys came from, such as MCC (Mobile Country Code).
+   */
+  char *region;
+  /*
+   * For example, file 2 in batch size of 10. Ordinal, 1-based numbering.
+   */
+  protobuf_c_boolean has_batch_num;
+  int32_t batch_num;
+  protobuf_c_boolean has_batch_size;
+  int32_t batch_size;
+  /*
+   * Information about associated signatures
+   */
+  size_t n_signature_infos;
+  SignatureInfo **signature_infos;
+  /*
+   * The TemporaryExposureKeys for initial release of keys.
+   */
+  size_t n_keys;
+  TemporaryExposureKey **keys;
+  /*
+   * TemporaryExposureKeys that have changed status.
+   */
+  size_t n_revised_keys;
+  TemporaryExposureKey **revised_keys;
+};
+#define TEMPORARY_EXPOSURE_KEY_EXPORT__INIT \
+ { PROTOBUF_C_MESSAGE_INIT (&temporary_exposure_key_export__descriptor) \
+    , 0, 0, 0, 0, NULL, 0, 0, 0, 0, 0,NULL, 0,NULL, 0,NULL }
+
+
+struct  _SignatureInfo
+{
+  ProtobufCMessage base;
+  /*
+   * Key version for rollovers
+   */
+  char *verification_key_version;
+  /*
+   * Alias with which to identify public key to be used for verification
+   */
+  char *verification_key_id;
+  /*
+   * ASN.1 OID for Algorithm Identifier. For example, `1.2.840.10045.4.3.2'
+   */
+  char *signature_algorithm;
+};
+#define SIGNATURE_INFO__INIT \
+ { PROTOBUF_C_MESSAGE_INIT (&signature_info__descriptor) \
+    , NULL, NULL, NULL }
+
+
+struct  _TemporaryExposureKey
+{
+  ProtobufCMessage base;
+  /*
+   * Key of infected user
+   */
+  protobuf_c_boolean has_key_data;
+  ProtobufCBinaryData key_data;
+  /*
+   * Varying risk associated with a key depending on diagnosis method
+   */
+  protobuf_c_boolean has_transmission_risk_level PROTOBUF_C__DEPRECATED;
+  int32_t transmission_risk_level PROTOBUF_C__DEPRECATED;
+  /*
+   * The interval number since epoch for which a key starts
+   */
+  protobuf_c_boolean has_rolling_start_interval_number;
+  int32_t rolling_start_interval_number;
+  /*
+   * Increments of 10 minutes describing how long a key is valid
+   */
+  protobuf_c_boolean has_rolling_period;
+  int32_t rolling_period;
+  /*
+   * Type of diagnosis associated with a key.
+   */
+  protobuf_c_boolean has_report_type;
+  TemporaryExposureKey__ReportType report_type;
+  /*
+   * Number of days elapsed between symptom onset and the TEK being used.
+   */
+  protobuf_c_boolean has_days_since_onset_of_symptoms;
+  int32_t days_since_onset_of_symptoms;
+};
+#define TEMPORARY_EXPOSURE_KEY__INIT \
+ { PROTOBUF_C_MESSAGE_INIT (&temporary_exposure_key__descriptor) \
+    , 0, {0,NULL}, 0, 0, 0, 0, 0, 144, 0, TEMPORARY_EXPOSURE_KEY__REPORT_TYPE__UNKNOWN, 0, 0 }
+
+
+/* TemporaryExposureKeyExport methods */
+void   temporary_exposure_key_export__init
+                     (TemporaryExposureKeyExport         *message);
+size_t temporary_exposure_key_export__get_packed_size
+                     (const TemporaryExposureKeyExport   *message);
+size_t temporary_exposure_key_export__pack
+                     (const TemporaryExposureKeyExport   *message,
+                      uint8_t             *out);
+size_t temporary_exposure_key_export__pack_to_buffer
+                     (const TemporaryExposureKeyExport   *message,
+                      ProtobufCBuffer     *buffer);
+TemporaryExposureKeyExport *
+       temporary_exposure_key_export__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data);
+void   temporary_exposure_key_export__free_unpacked
+                     (TemporaryExposureKeyExport *message,
+                      ProtobufCAllocator *allocator);
+/* SignatureInfo methods */
+void   signature_info__init
+                     (SignatureInfo         *message);
+size_t signature_info__get_packed_size
+                     (const SignatureInfo   *message);
+size_t signature_info__pack
+                     (const SignatureInfo   *message,
+                      uint8_t             *out);
+size_t signature_info__pack_to_buffer
+                     (const SignatureInfo   *message,
+                      ProtobufCBuffer     *buffer);
+SignatureInfo *
+       signature_info__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data);
+void   signature_info__free_unpacked
+                     (SignatureInfo *message,
+                      ProtobufCAllocator *allocator);
+/* TemporaryExposureKey methods */
+void   temporary_exposure_key__init
+                     (TemporaryExposureKey         *message);
+size_t temporary_exposure_key__get_packed_size
+                     (const TemporaryExposureKey   *message);
+size_t temporary_exposure_key__pack
+                     (const TemporaryExposureKey   *message,
+                      uint8_t             *out);
+size_t temporary_exposure_key__pack_to_buffer
+                     (const TemporaryExposureKey   *message,
+                      ProtobufCBuffer     *buffer);
+TemporaryExposureKey *
+       temporary_exposure_key__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data);
+void   temporary_exposure_key__free_unpacked
+                     (TemporaryExposureKey *message,
+                      ProtobufCAllocator *allocator);
+/* --- per-message closures --- */
+
+typedef void (*TemporaryExposureKeyExport_Closure)
+                 (const TemporaryExposureKeyExport *message,
+                  void *closure_data);
+typedef void (*SignatureInfo_Closure)
+                 (const SignatureInfo *message,
+                  void *closure_data);
+typedef void (*TemporaryExposureKey_Closure)
+                 (const TemporaryExposureKey *message,
+                  void *closure_data);
+
+/* --- services --- */
+
+
+/* --- descriptors --- */
+
+extern const ProtobufCMessageDescriptor temporary_exposure_key_export__descriptor;
+extern const ProtobufCMessageDescriptor signature_info__descriptor;
+extern const ProtobufCMessageDescriptor temporary_exposure_key__descriptor;
+extern const ProtobufCEnumDescriptor    temporary_exposure_key__report_type__descriptor;
+
+PROTOBUF_C__END_DECLS
+
+
+#endif  /* PROTOBUF_C_export_2eproto__INCLUDED */
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2020 Olaf Landsiedel
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef EXPOSURE_CHECK_H
+#define EXPOSURE_CHECK_H
+
+#include <zephyr/types.h>
+#include <exposure-notification.h>
+#include "record_storage.h"
+
+/**
+ * EXPOSURE CHECK
+ *
+ * Match published temporary exposure keys against our stored records. A record matches a key, if its rolling proximity
+ * identifier was derived from the key for an interval within EXPOSURE_CHECK_TOLERANCE_INTERVALS of the record's
+ * timestamp (clocks of both devices may differ).
+ */
+
+#define EXPOSURE_CHECK_TOLERANCE_INTERVALS 12  // two hours, as suggested by the EN specification
+
+typedef struct exposure_key {
+    ENPeriodKey key;
+    ENIntervalNumber rolling_start_interval_number;
+    uint32_t rolling_period;  // amount of intervals the key was used for, 0 for a whole day
+} exposure_key_t;
+
+/**
+ * Called for each stored record matching a key.
+ *
+ * @param key the matching key
+ * @param interval the interval of the key, the identifier of the record was derived for
+ * @param record the matching record
+ */
+typedef void (*exposure_match_cb_t)(const exposure_key_t* key,
+                                    ENIntervalNumber interval,
+                                    const record_t* record,
+                                    void* userdata);
+
+/**
+ * State of checking a stream of keys one by one.
+ */
+typedef struct exposure_check_ctx {
+    exposure_match_cb_t cb;
+    void* userdata;
+    bool empty;                       // we have no stored records
+    ENIntervalNumber first_interval;  // interval of our oldest stored record
+    ENIntervalNumber last_interval;   // interval of our newest stored record
+    uint32_t keys;                    // amount of processed keys
+    uint32_t skipped_keys;            // amount of keys without any stored records in their time window
+    uint32_t derived;                 // amount of derived identifiers
+} exposure_check_ctx_t;
+
+/**
+ * Start checking a stream of keys against the records stored right now.
+ *
+ * @return 0 on success
+ */
+int exposure_check_init(exposure_check_ctx_t* ctx, exposure_match_cb_t cb, void* userdata);
+
+/**
+ * Check a single key. Identifiers are only derived for intervals, which have stored records within our tolerance. Each
+ * of them is looked up in the bloom filter partition of its day, the stored records around its interval are only read
+ * for hits. Keys outside the time range of our stored records are skipped right away.
+ *
+ * @return the amount of matches, negative on error
+ */
+int exposure_check_process_key(exposure_check_ctx_t* ctx, const exposure_key_t* key);
+
+/**
+ * Check a key with exposure_check_process_key as soon as it was decoded from a key export, see key_export.h.
+ *
+ * @param userdata the exposure_check_ctx_t
+ * @return 0 on success, negative on error
+ */
+int exposure_check_on_exported_key(const exposure_key_t* key, void* userdata);
+
+/**
+ * Check a batch of keys with exposure_check_process_key.
+ *
+ * @return the amount of matches, negative on error
+ */
+int exposure_check_forward(const exposure_key_t* keys, size_t count, exposure_match_cb_t cb, void* userdata);
+
+/**
+ * Check a batch of keys with a bloom filter of all their identifiers. Our stored records are read in a single pass and
+ * looked up in this filter, only hits are checked against the keys. Needs less work than exposure_check_forward, if
+ * the batch is small compared to our stored records. Our stored records are read once for every
+ * CONFIG_ENS_EXPOSURE_REVERSE_BLOOM_ENTRIES identifiers.
+ *
+ * @return the amount of matches, negative on error
+ */
+int exposure_check_reverse(const exposure_key_t* keys, size_t count, exposure_match_cb_t cb, void* userdata);
+
+/**
+ * Check a batch of keys with a hash table of all their identifiers. The table stores a fingerprint of each identifier
+ * together with its key and interval, so matches are exact after deriving a single identifier again. Our stored
+ * records are read once for every CONFIG_ENS_EXPOSURE_JOIN_TABLE_SIZE * 3 / 4 identifiers.
+ *
+ * @return the amount of matches, negative on error
+ */
+int exposure_check_hash_join(const exposure_key_t* keys, size_t count, exposure_match_cb_t cb, void* userdata);
+
+/**
+ * Check a batch of keys with the configured mode (see CONFIG_CONTACTS_HASH_JOIN and CONFIG_CONTACTS_BLOOM_REVERSE).
+ *
+ * @return the amount of matches, negative on error
+ */
+int exposure_check(const exposure_key_t* keys, size_t count, exposure_match_cb_t cb, void* userdata);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef FUSE_FILTER_H
+#define FUSE_FILTER_H
+
+#include <zephyr/types.h>
+#include "exposure-notification.h"
+
+/**
+ * Max amount of keys of a fuse filter, construction indexes keys and slots with 16 bits.
+ */
+#define FUSE_FILTER_MAX_KEYS 32768
+
+/**
+ * Immutable binary fuse filter with 8-bit fingerprints. Needs about 9 bits per key for a false positive rate of about
+ * 0.4% and a lookup only reads three fingerprints.
+ */
+typedef struct {
+    uint64_t seed;
+    uint32_t count;                 // amount of keys
+    uint32_t segment_length;
+    uint32_t segment_count_length;  // amount of slots, the first fingerprint can be in
+    uint32_t array_length;          // amount of fingerprints
+    uint8_t* fingerprints;
+} fuse_filter_t;
+
+/**
+ * Get the size of the fingerprints of a fuse filter with the given amount of keys.
+ *
+ * @return the size in bytes
+ */
+uint32_t fuse_filter_size(uint32_t count);
+
+/**
+ * Allocate an empty fuse filter for the given amount of keys.
+ *
+ * @return the filter or NULL, if it could not be allocated
+ */
+fuse_filter_t* fuse_filter_init(uint32_t count);
+
+/**
+ * Build a fuse filter of the given keys. Duplicate keys are allowed, keys are sorted in place. Besides the filter,
+ * the construction temporarily needs 4 bytes per slot of the filter (about 5.5 bytes per key).
+ *
+ * @param keys the keys to add
+ * @param count the amount of keys, at most FUSE_FILTER_MAX_KEYS
+ *
+ * @return the filter or NULL, if it could not be built (e.g. not enough memory)
+ */
+fuse_filter_t* fuse_filter_build(uint32_t* keys, uint32_t count);
+
+void fuse_filter_destroy(fuse_filter_t* filter);
+
+bool fuse_filter_contains(const fuse_filter_t* filter, uint32_t key);
+
+/**
+ * Get the key of a rolling proximity identifier. Uses other bytes than the bloom filter hashes.
+ */
+static inline uint32_t fuse_filter_key_from_rpi(const ENIntervalIdentifier* rpi) {
+    uint32_t key = 0;
+    for (int i = 11; i >= 8; i--) {
+        key = (key << 8) | rpi->b[i];
+    }
+    return key;
+}
+
+#endif
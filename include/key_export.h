@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2020 Olaf Landsiedel
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef KEY_EXPORT_H
+#define KEY_EXPORT_H
+
+#include <zephyr/types.h>
+#include "exposure_check.h"
+
+/**
+ * KEY EXPORT
+ *
+ * Streaming decoder of the exposure key export file format: the 16 byte header "EK Export v1    " followed by a
+ * serialized TemporaryExposureKeyExport message, see
+ * https://developers.google.com/android/exposure-notifications/exposure-key-file-format
+ * The file is fed in chunks of any size, e.g. as they arrive over BLE or are read from flash, and each
+ * TemporaryExposureKey is reported as soon as it is complete. Only a single key message is buffered, so the memory
+ * usage does not depend on the file size.
+ *
+ * Only the keys field is reported. The revised keys only update the metadata of already published keys, the other
+ * fields (signature infos, region, ...) are skipped.
+ *
+ * Key messages are decoded by a parser specialized on the TemporaryExposureKey schema, which reads the key data in
+ * place and only keeps the fields needed for matching. Messages it does not understand (unknown fields, unexpected wire
+ * types or out of range values) are unpacked by protobuf-c instead.
+ */
+
+#define KEY_EXPORT_HEADER "EK Export v1    "
+#define KEY_EXPORT_HEADER_SIZE (sizeof(KEY_EXPORT_HEADER) - 1)
+
+// a TemporaryExposureKey with all fields takes 41 bytes, leave some room for future fields
+#define KEY_EXPORT_MAX_KEY_SIZE 64
+
+/**
+ * A TemporaryExposureKey parsed in place.
+ */
+typedef struct key_export_key_view {
+    const uint8_t* key_data;  // the 16 bytes of the key within the message
+    ENIntervalNumber rolling_start_interval_number;
+    uint32_t rolling_period;  // 0 if not set
+} key_export_key_view_t;
+
+/**
+ * Called for each decoded key.
+ *
+ * @return 0 to continue, a negative error code to abort decoding
+ */
+typedef int (*key_export_cb_t)(const exposure_key_t* key, void* userdata);
+
+typedef struct key_export_decoder {
+    key_export_cb_t cb;
+    void* userdata;
+    uint8_t state;
+    uint8_t wire_type;
+    uint8_t varint_shift;
+    uint32_t field;
+    uint64_t varint;
+    uint32_t offset;     // position within the header, fixed size value or key message
+    uint32_t remaining;  // bytes left of the current length delimited field
+    uint8_t key_message[KEY_EXPORT_MAX_KEY_SIZE];
+    uint32_t keys;          // amount of reported keys
+    uint32_t invalid_keys;  // amount of skipped keys (without valid key data or too large)
+    uint32_t copied_keys;   // amount of key messages split over chunks, which had to be buffered
+} key_export_decoder_t;
+
+/**
+ * Start decoding a new export file.
+ */
+void key_export_decoder_init(key_export_decoder_t* decoder, key_export_cb_t cb, void* userdata);
+
+/**
+ * Decode the next chunk of the file.
+ *
+ * @param data the chunk
+ * @param size the size of the chunk
+ * @return 0 on success, -EINVAL for malformed files or the error of the callback
+ */
+int key_export_decoder_feed(key_export_decoder_t* decoder, const uint8_t* data, size_t size);
+
+/**
+ * Check, that the file ended after a complete field.
+ *
+ * @return 0 on success, -EINVAL if the file was truncated
+ */
+int key_export_decoder_finish(key_export_decoder_t* decoder);
+
+/**
+ * Parse a serialized TemporaryExposureKey without copying the key data.
+ *
+ * @param message the serialized message
+ * @param size the size of the message
+ * @param view the parsed key, its key data points into the message
+ * @return 0 on success, -EINVAL if the message has no key data, -ENOTSUP if the message needs the generic decoder
+ */
+int key_export_parse_key(const uint8_t* message, size_t size, key_export_key_view_t* view);
+
+/**
+ * Unpack a serialized TemporaryExposureKey with the specialized parser, falling back to protobuf-c.
+ *
+ * @param message the serialized message, at most KEY_EXPORT_MAX_KEY_SIZE bytes
+ * @param size the size of the message
+ * @param key the unpacked key
+ * @return 0 on success, -EINVAL if the message is malformed or has no valid key data
+ */
+int key_export_unpack_key(const uint8_t* message, size_t size, exposure_key_t* key);
+
+/**
+ * Unpack a serialized TemporaryExposureKey with protobuf-c only.
+ *
+ * @param message the serialized message, at most KEY_EXPORT_MAX_KEY_SIZE bytes
+ * @param size the size of the message
+ * @param key the unpacked key
+ * @return 0 on success, -EINVAL if the message is malformed or has no valid key data
+ */
+int key_export_unpack_key_protobuf(const uint8_t* message, size_t size, exposure_key_t* key);
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2020 Olaf Landsiedel
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef RECORD_BLOOM_H
+#define RECORD_BLOOM_H
+
+#include <zephyr/types.h>
+#include <exposure-notification.h>
+#include "record_storage.h"
+
+/**
+ * RECORD BLOOM FILTER
+ *
+ * The rolling proximity identifiers of our stored records, with one bloom filter partition per day (EN rolling
+ * period). Records are added by the record storage, which also drops partitions as soon as all records of their day
+ * are erased. A lookup for a temporary exposure key therefore only needs the partition of its rolling start interval.
+ *
+ * Once a day is over, its partition is compacted to an immutable fuse filter, which needs less memory at a lower false
+ * positive rate. The partitions are snapshotted to the bloom_storage flash partition, together with the sn of the
+ * first record not contained in the snapshot. At boot, only records from there on need to be added again.
+ */
+
+/**
+ * Initialize the partitions from our snapshot and the records stored after it, or from all stored records if there is
+ * no valid snapshot. Needs to be called after the record storage is initialized.
+ *
+ * @return the amount of added records, negative on error
+ */
+int record_bloom_init();
+
+/**
+ * Add a stored record to the partition of its day.
+ *
+ * @return true, if the record started a new partition (i.e. a good time for a snapshot)
+ */
+bool record_bloom_add(const record_t* record);
+
+/**
+ * Replace the bloom filters of days before yesterday with fuse filters of their stored records. Reads all records of
+ * these days, so better call it from a background thread.
+ *
+ * @return the amount of compacted partitions
+ */
+int record_bloom_compact();
+
+/**
+ * Write a snapshot of all partitions to flash. Blocks adding records while writing, so better call it from a
+ * background thread.
+ *
+ * @return 0 on success
+ */
+int record_bloom_snapshot();
+
+/**
+ * Drop all partitions of days before the day of the given timestamp.
+ *
+ * @param oldest_timestamp timestamp of our oldest stored record
+ */
+void record_bloom_expire(uint32_t oldest_timestamp);
+
+/**
+ * Drop all partitions and our snapshot.
+ */
+void record_bloom_clear();
+
+/**
+ * Get the intervals, during which we might have stored records.
+ *
+ * @param first the first interval
+ * @param count the amount of intervals
+ * @param bitmap destination of (count + 7) / 8 bytes, bit i is set for interval first + i
+ */
+void record_bloom_get_intervals(ENIntervalNumber first, uint32_t count, uint8_t* bitmap);
+
+/**
+ * Check, if we might have stored the rolling proximity identifier.
+ *
+ * @param rpi the identifier to check
+ * @param rolling_start_interval_number the rolling start of the key, the identifier was derived from
+ *
+ * @return false, if we definitely did not store the identifier during the day of the key
+ */
+bool record_bloom_probably_has(ENIntervalIdentifier* rpi, ENIntervalNumber rolling_start_interval_number);
+
+#endif
@@ -31,14 +31,26 @@ typedef struct associated_encrypted_metadata {
 typedef struct record {
     record_sequence_number_t sn;  // TODO: Convert Sequence Number
     uint32_t timestamp;           // TODO: Seconds from january first 2000 (UTC+0)
-    uint8_t rssi;                  // TODO: Check correct
+    uint8_t rssi;                  // Mean RSSI of all sightings, TODO: Check correct
     ENIntervalIdentifier rolling_proximity_identifier;
     associated_encrypted_metadata_t associated_encrypted_metadata;
+    uint8_t rssi_max;              // Max RSSI of all sightings
+    uint8_t duration;              // Minutes between first (timestamp) and last sighting
 } __packed record_t;
 
+// layout of record_t, needs to be incremented on every change, as stored records of other layouts cannot be read
+#define RECORD_LAYOUT_VERSION 2
+
+/**
+ * Encounters are aggregated in RAM and appended as record up to this many seconds after their first sighting (the
+ * timestamp of the record), see encounter.h. So timestamps only increase with the sequence number up to this delay.
+ */
+#define RECORD_MAX_APPEND_DELAY (CONFIG_ENS_ENCOUNTER_MAX_DURATION + CONFIG_ENS_ENCOUNTER_TIMEOUT)
+
 typedef struct stored_records_information {
     record_sequence_number_t oldest_contact;
     uint32_t count;
+    uint32_t layout_version;  // RECORD_LAYOUT_VERSION of the stored records
 } stored_records_information_t;
 
 /**
@@ -117,6 +129,18 @@ typedef struct record_iterator {
      * @internal
      */
     uint8_t finished;
+    /**
+     * @internal prefetched records, read with a single flash read
+     */
+    uint8_t buffer[CONFIG_ENS_RECORD_ITERATOR_BUFFER_SIZE];
+    /**
+     * @internal amount of valid records in buffer
+     */
+    uint16_t buffered;
+    /**
+     * @internal index of the next record in buffer
+     */
+    uint16_t buffer_pos;
 } record_iterator_t;
 
 // Also uses start and end from storage if NULL pointers given
@@ -126,8 +150,15 @@ int ens_records_iterator_init_range(record_iterator_t* iterator,
                                     record_sequence_number_t* opt_start,
                                     record_sequence_number_t* opt_end);
 
-// TODO: Do we guarantee that higher sequence numbers have at least our timestamp and lower sequence numbers up to our
-// timestamp?
+/**
+ * Iterate over all records with timestamps from ts_start to ts_end (inclusive). As records are not strictly sorted by
+ * their timestamps, the range is widened by RECORD_MAX_APPEND_DELAY and the iterator also returns records outside of
+ * it, which the caller needs to skip.
+ *
+ * @param ts_start the first timestamp or NULL for the oldest record
+ * @param ts_end the last timestamp or NULL for the latest record
+ * @return 0 on success
+ */
 int ens_records_iterator_init_timerange(record_iterator_t* iterator, time_t* ts_start, time_t* ts_end);
 
 record_t* ens_records_iterator_next(record_iterator_t* iter);
@@ -11,6 +11,17 @@
 #include "utility/sequencenumber.h"
 #include "record_storage.h"
 
+/**
+ * TEK STORAGE
+ *
+ * Our own temporary exposure keys are kept in a ring on the tek_storage flash partition for TEK_STORAGE_DAYS. A
+ * directory in RAM holds the latest key of each period, so looking up a key takes a single flash read. Keys are
+ * expired automatically, whenever a key of a newer period is added or requested.
+ */
+
+// the EN specification asks to keep keys for 14 days
+#define TEK_STORAGE_DAYS 14
+
 typedef struct tek {
     uint32_t timestamp;     // Seconds from january first 2000 (UTC+0)
     ENPeriodKey tek;        // the temporary exposure key
@@ -24,11 +35,29 @@ typedef struct tek {
  */
 int tek_storage_init(bool clean);
 
+/**
+ * Store a key. It replaces an earlier key of the same period, i.e. the period containing its timestamp.
+ *
+ * @param src the key
+ * @return 0 on success, -EINVAL if a key of a period TEK_STORAGE_DAYS later is stored already, -EIO on flash errors
+ */
 int tek_storage_add(tek_t* src);
+
+/**
+ * Delete a stored key.
+ *
+ * @param src the key
+ * @return 0 on success, -ENOENT if the key is not stored
+ */
 int tek_storage_delete(tek_t* src);
 
 /**
- * Returns 0 on success, else non zero (if none available)
+ * Get the latest key of the period containing the given timestamp. Keys TEK_STORAGE_DAYS or more before this period
+ * are expired.
+ *
+ * @param dest the key
+ * @param timestamp the timestamp
+ * @return 0 on success, -ENOENT if there is no key for this period, -EIO on flash errors
  */
 int tek_storage_get_latest_at_ts(tek_t* dest, uint32_t timestamp);
 
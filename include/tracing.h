@@ -10,4 +10,20 @@
 int tracing_init(void);
 uint32_t tracing_run(void);
 
+/**
+ * Store all open encounters as records and wait until they are written, e.g. before checking for exposures or
+ * shutting down. Must not be called from the contact storage thread.
+ *
+ * @return 0 on success, -EAGAIN if the contact storage thread did not finish in time
+ */
+int tracing_flush_encounters(void);
+
+/**
+ * Get statistics of the queue between the scan callback and the contact storage thread.
+ *
+ * @param high_water destination for the max amount of queued contacts so far
+ * @param dropped destination for the amount of contacts dropped, because the queue was full
+ */
+void tracing_get_contact_queue_stats(uint32_t* high_water, uint32_t* dropped);
+
 #endif
\ No newline at end of file
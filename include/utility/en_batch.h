@@ -0,0 +1,91 @@
+#ifndef EN_BATCH_H
+#define EN_BATCH_H
+
+#include <stddef.h>
+#include <exposure-notification.h>
+
+/**
+ * Host builds (the desktop environment and native_posix) are used for large-scale matching, so they derive the
+ * identifiers with AES-NI, if the CPU has it, or with a bitsliced implementation otherwise. Embedded builds use
+ * mbedtls, which is backed by the CC310.
+ */
+#if !defined(__ZEPHYR__) || defined(CONFIG_ARCH_POSIX)
+#define EN_BATCH_HOST 1
+#else
+#define EN_BATCH_HOST 0
+#include <mbedtls/aes.h>
+#endif
+
+#define EN_BATCH_AES_ROUNDS 10
+
+/**
+ * Prepared key schedule of a period identifier key.
+ */
+typedef struct en_batch_key {
+#if EN_BATCH_HOST
+    uint8_t round_keys[EN_BATCH_AES_ROUNDS + 1][sizeof(ENPeriodIdentifierKey)];
+#else
+    mbedtls_aes_context aes;
+#endif
+} en_batch_key_t;
+
+/**
+ * Expand a period identifier key for deriving identifiers with it.
+ *
+ * @param key the key schedule to set up, needs to be cleared with en_batch_key_clear afterwards
+ * @param pik the period identifier key
+ * @return 0 on success
+ */
+int en_batch_key_setup(en_batch_key_t* key, const ENPeriodIdentifierKey* pik);
+
+/**
+ * Release and zeroize a key schedule.
+ */
+void en_batch_key_clear(en_batch_key_t* key);
+
+/**
+ * Derive the rolling proximity identifiers of a list of intervals or of consecutive intervals with a prepared key.
+ *
+ * @param rpis array of at least count identifiers to fill
+ * @param key the key schedule of the period identifier key
+ * @param first the first interval, if intervals is NULL
+ * @param intervals the intervals to derive the identifiers for or NULL for consecutive intervals starting at first
+ * @param count amount of intervals
+ * @return 0 on success
+ */
+int en_batch_derive_with_key(ENIntervalIdentifier* rpis,
+                             en_batch_key_t* key,
+                             ENIntervalNumber first,
+                             const ENIntervalNumber* intervals,
+                             size_t count);
+
+/**
+ * Derive the rolling proximity identifiers of consecutive intervals of a period identifier key. Yields the same
+ * identifiers as calling en_derive_interval_identifier for each interval, but sets up the AES key only once.
+ *
+ * @param rpis array of at least count identifiers to fill
+ * @param pik the period identifier key
+ * @param first the first interval to derive the identifier for
+ * @param count amount of intervals, e.g. EN_TEK_ROLLING_PERIOD for all identifiers of a key
+ * @return 0 on success
+ */
+int en_batch_derive_interval_identifiers(ENIntervalIdentifier* rpis,
+                                         const ENPeriodIdentifierKey* pik,
+                                         ENIntervalNumber first,
+                                         size_t count);
+
+/**
+ * Derive the rolling proximity identifiers of a list of intervals of a period identifier key.
+ *
+ * @param rpis array of at least count identifiers to fill
+ * @param pik the period identifier key
+ * @param intervals the intervals to derive the identifiers for
+ * @param count amount of intervals
+ * @return 0 on success
+ */
+int en_batch_derive_interval_identifiers_list(ENIntervalIdentifier* rpis,
+                                              const ENPeriodIdentifierKey* pik,
+                                              const ENIntervalNumber* intervals,
+                                              size_t count);
+
+#endif  // EN_BATCH_H
@@ -0,0 +1,43 @@
+#ifndef EN_KEY_CACHE_H
+#define EN_KEY_CACHE_H
+
+#include <exposure-notification.h>
+#include "utility/en_batch.h"
+
+/**
+ * Keys derived from a temporary exposure key, ready for deriving identifiers. The metadata encryption key is only
+ * derived on its first use, see en_key_cache_get_pmek.
+ */
+typedef struct en_key_context {
+    ENPeriodKey tek;
+    ENPeriodIdentifierKey pik;
+    ENPeriodMetadataEncryptionKey pmek;
+    bool has_pmek;           // pmek is derived
+    en_batch_key_t rpi_key;  // expanded period identifier key
+    uint32_t last_used;      // 0 for unused entries
+} en_key_context_t;
+
+/**
+ * Get the derived keys of a TEK from the least recently used cache of CONFIG_ENS_KEY_CACHE_SIZE entries. On a miss,
+ * the least recently used entry is zeroized and replaced.
+ * Tracing and the exposure check run in the main thread, so the cache is not locked.
+ *
+ * @param tek the temporary exposure key
+ * @return the context, valid until CONFIG_ENS_KEY_CACHE_SIZE other keys were requested, NULL on errors
+ */
+en_key_context_t* en_key_cache_get(const ENPeriodKey* tek);
+
+/**
+ * Get the metadata encryption key of a cached context, deriving it on the first call.
+ *
+ * @param context the context returned by en_key_cache_get
+ * @return the period metadata encryption key
+ */
+const ENPeriodMetadataEncryptionKey* en_key_cache_get_pmek(en_key_context_t* context);
+
+/**
+ * Zeroize all cached keys.
+ */
+void en_key_cache_clear(void);
+
+#endif  // EN_KEY_CACHE_H
@@ -37,6 +37,11 @@ typedef struct ens_fs {
      * Lock for this fs.
      */
     struct k_mutex ens_fs_lock;
+    /**
+     * Lock for erasing sectors. Erasing only holds ens_fs_lock to update the write cursor, so reads and writes to other
+     * sectors are not blocked.
+     */
+    struct k_mutex erase_lock;
     /**
      * Size for entries, which is used interally.
      *
@@ -50,10 +55,44 @@ typedef struct ens_fs {
      */
     // TODO lome: maybe move this into functions where it's needed?
     uint8_t* buffer;
+    /**
+     * Write cursor for each sector: the amount of entries at the start of the sector which are in use. All entries
+     * from the cursor to the end of the sector are erased. Built in ens_fs_init, so writes never read flash to check
+     * whether their entry is erased.
+     */
+    uint16_t* sector_cursor;
+    /**
+     * Staging buffer of size page_size, which combines consecutive appends into one flash program operation. Entries
+     * are staged at the same offset they have inside their program page.
+     */
+    uint8_t* page_buffer;
+    /**
+     * Size of a program page of the flash. Has to be a multiple of interal_size.
+     */
+    size_t page_size;
+    /**
+     * Id of the first staged entry.
+     */
+    uint64_t staged_start;
+    /**
+     * Amount of currently staged entries.
+     */
+    uint16_t staged_count;
+    /**
+     * Amount of erased entries starting at staged_start, i.e. the maximum amount of entries we can stage.
+     */
+    uint16_t staged_limit;
+    /**
+     * Work for flushing staged entries after CONFIG_ENS_FS_FLUSH_TIMEOUT_MS.
+     */
+    struct k_delayed_work flush_work;
 } ens_fs_t;
 
 /**
- * Initialize the file system.
+ * Initialize the file system. Scans each sector once to initialize its write cursor.
+ *
+ * Entries of a sector are expected to be written in order (as done by ens_fs_append). Writing an entry behind the
+ * cursor of its sector marks all entries in between as in use.
  *
  * @param fs file system
  * @param id id of the partition
@@ -74,6 +113,19 @@ int ens_fs_init(ens_fs_t* fs, uint8_t flash_id, uint64_t entry_size);
  */
 int ens_fs_read(ens_fs_t* fs, uint64_t id, void* dest);
 
+/**
+ * Read a range of consecutive entries with a single flash read. Invalid and deleted entries are skipped, all valid
+ * entries are moved to the start of the buffer in order, each entry_size bytes long.
+ *
+ * @param fs file system
+ * @param id id of the first entry
+ * @param count amount of entries to read
+ * @param buffer destination, has to be at least count * interal_size bytes, as raw entries are read into it
+ *
+ * @return the amount of valid entries in buffer, -errno otherwise
+ */
+int ens_fs_read_range(ens_fs_t* fs, uint64_t id, size_t count, void* buffer);
+
 /**
  * Write data to the file system.
  *
@@ -85,6 +137,28 @@ int ens_fs_read(ens_fs_t* fs, uint64_t id, void* dest);
  */
 int ens_fs_write(ens_fs_t* fs, uint64_t id, void* data);
 
+/**
+ * Append data to the file system. Consecutive appends are staged in RAM and written with a single flash operation as
+ * soon as their program page is full, ens_fs_flush is called or CONFIG_ENS_FS_FLUSH_TIMEOUT_MS passed. Until then,
+ * staged entries are readable but not durable.
+ *
+ * @param fs file system
+ * @param id id of the entry
+ * @param data data to be written
+ *
+ * @return 0 on success, -ENS_ADDRINU if the entry is not erased, -errno otherwise
+ */
+int ens_fs_append(ens_fs_t* fs, uint64_t id, void* data);
+
+/**
+ * Write all staged entries to flash.
+ *
+ * @param fs file system
+ *
+ * @return 0 on success, -errno otherwise
+ */
+int ens_fs_flush(ens_fs_t* fs);
+
 /**
  * Delete an entry from the file system.
  *
@@ -105,4 +179,26 @@ int ens_fs_delete(ens_fs_t* fs, uint64_t id);
  */
 uint64_t ens_fs_make_space(ens_fs_t* fs, uint64_t id);
 
+/**
+ * Erase the sector starting at the given id ahead of time, e.g. from a background worker. In contrast to
+ * ens_fs_make_space, the sector is only erased if all of its entries are in use. Sectors, which were erased or written
+ * to in the meantime, are left untouched.
+ *
+ * @param fs file system
+ * @param id id of the first entry of the sector
+ *
+ * @return the positive amount of deleted entries, 0 if the sector was not erased, -errno otherwise
+ */
+int ens_fs_pre_erase(ens_fs_t* fs, uint64_t id);
+
+/**
+ * Check, if the given entry is erased, i.e. can be written. All following entries of its sector are erased as well.
+ *
+ * @param fs file system
+ * @param id id of the entry
+ *
+ * @return true, if the entry is erased
+ */
+bool ens_fs_is_erased(ens_fs_t* fs, uint64_t id);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,69 @@
+#ifndef PB_ARENA_H
+#define PB_ARENA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "protobuf-c.h"
+
+/**
+ * Bump pointer allocator for unpacking protobuf messages into a caller provided buffer. Unpacking a batch of keys
+ * with the default allocator needs a k_malloc per message, repeated field and bytes field, which quickly fragments the
+ * heap. With the arena, all of them are placed one after another and freed at once by resetting the arena.
+ * Freeing single allocations only gives back the memory of the latest one.
+ */
+
+#define PB_ARENA_ALIGNMENT 8
+
+// the unpacked TemporaryExposureKey structs (with their key data) take about 3 times the size of their wire format
+#define PB_ARENA_WIRE_FACTOR 4
+#define PB_ARENA_MESSAGE_OVERHEAD 128
+
+// arena size for unpacking a message of the given wire length, usable for static buffers
+#define PB_ARENA_SIZE_FOR(wire_length) ((wire_length) * PB_ARENA_WIRE_FACTOR + PB_ARENA_MESSAGE_OVERHEAD)
+
+typedef struct pb_arena {
+    ProtobufCAllocator allocator;  // pass this to the unpack functions
+    uint8_t* buffer;
+    size_t size;
+    size_t used;
+    size_t last;        // offset of the latest allocation
+    size_t high_water;  // maximum of used bytes since init
+    uint32_t failed;    // amount of allocations, which did not fit
+} pb_arena_t;
+
+/**
+ * Set up an arena in the given buffer.
+ *
+ * @param arena the arena
+ * @param buffer the buffer to allocate from, has to be aligned to PB_ARENA_ALIGNMENT
+ * @param size size of the buffer
+ */
+void pb_arena_init(pb_arena_t* arena, void* buffer, size_t size);
+
+/**
+ * Free all allocations at once, e.g. after processing an unpacked batch. Keeps the high-water mark.
+ */
+static inline void pb_arena_reset(pb_arena_t* arena) {
+    arena->used = 0;
+    arena->last = 0;
+}
+
+/**
+ * Estimate the arena size needed for unpacking a message of the given wire length.
+ *
+ * @param wire_length the length of the serialized message
+ * @return the size in bytes
+ */
+static inline size_t pb_arena_size_for(size_t wire_length) {
+    return PB_ARENA_SIZE_FOR(wire_length);
+}
+
+/**
+ * Check, if a message of the given wire length will probably fit into the free space of the arena.
+ */
+static inline bool pb_arena_fits(const pb_arena_t* arena, size_t wire_length) {
+    return arena->size - arena->used >= pb_arena_size_for(wire_length);
+}
+
+#endif  // PB_ARENA_H
@@ -39,6 +39,15 @@ record_sequence_number_t sn_decrement(record_sequence_number_t sn);
  */
 record_sequence_number_t sn_increment_by(record_sequence_number_t sn, uint32_t amount);
 
+/**
+ * Get the distance between two sequence numbers, while handling a possible wrap-around.
+ *
+ * @param older sequence number which will be treated as the older one
+ * @param newer sequence number which will be treated as the newer one
+ * @return the amount of increments needed to get from older to newer
+ */
+uint32_t sn_distance(record_sequence_number_t older, record_sequence_number_t newer);
+
 /**
  * Get the middle between to given sequence numbers, while handling a possible wrap-around.
  *
@@ -1,48 +1,173 @@
+#include <math.h>
+#include <string.h>
+#include <zephyr.h>
+
 #include "bloom.h"
 
+#define BLOOM_MAX_HASHES 16
+
+// blocked filters use blocks of 8 32-bit words and set one bit per word
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_BLOCK_BITS (BLOOM_BLOCK_WORDS * 32)
 
-// 64 KByte!
-static uint8_t bloom_data[1<<16];
+// odd constants for deriving the bit of each word from a single hash
+static const uint32_t block_salts[BLOOM_BLOCK_WORDS] = {0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d,
+                                                        0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31};
 
-bloom_filter_t* bloom_init(size_t size) {
+/**
+ * Get the two base hashes for double hashing. RPIs are AES outputs, so their bytes are already uniformly distributed.
+ * The second hash is odd, so it never is 0 and does not share factors with a power of 2.
+ */
+static inline void get_base_hashes(ENIntervalIdentifier* rpi, uint32_t* h1, uint32_t* h2) {
+    *h1 = (rpi->b[3] << 24) | (rpi->b[2] << 16) | (rpi->b[1] << 8) | rpi->b[0];
+    *h2 = ((rpi->b[7] << 24) | (rpi->b[6] << 16) | (rpi->b[5] << 8) | rpi->b[4]) | 1;
+}
+
+/**
+ * Allocate the bloom filter and its zeroed data.
+ */
+static bloom_filter_t* bloom_alloc(size_t size) {
     bloom_filter_t* bloom = k_calloc(1, sizeof(bloom_filter_t));
     if (!bloom) {
         return NULL;
     }
-    bloom->size = sizeof(bloom_data);
-    bloom->data = bloom_data;
+    bloom->size = size;
+    bloom->data = k_malloc(bloom->size);
     if (!bloom->data) {
         bloom->size = 0;
         k_free(bloom);
         return NULL;
     }
+    memset(bloom->data, 0, bloom->size);
+    return bloom;
+}
+
+/**
+ * False positive rate of a blocked filter with the given average amount of entries per block. The entries per block
+ * are poisson distributed, with j entries in a block each word has a bit set with probability 1 - (31/32)^j.
+ */
+static float blocked_fpr(float entries_per_block) {
+    // computed in double, the poisson terms underflow in float for larger amounts of entries
+    double fpr = 0;
+    double poisson = exp(-entries_per_block);  // P(j = 0)
+    for (int j = 0; j < entries_per_block * 4 + 32; j++) {
+        fpr += poisson * pow(1.0 - pow(31.0 / 32.0, j), BLOOM_BLOCK_WORDS);
+        poisson *= entries_per_block / (j + 1);
+    }
+    return fpr;
+}
+
+bloom_filter_t* bloom_init(size_t expected_count, float false_positive_rate) {
+    // optimal amount of bits m = -n * ln(p) / ln(2)^2 and hashes k = m / n * ln(2)
+    float n = MAX(expected_count, 1);
+    float m = ceilf(-n * logf(false_positive_rate) / (logf(2) * logf(2)));
+    uint32_t k = lroundf(m / n * logf(2));
+
+    bloom_filter_t* bloom = bloom_alloc(((uint32_t)m + 7) / 8);
+    if (!bloom) {
+        return NULL;
+    }
+    bloom->type = BLOOM_TYPE_STANDARD;
+    bloom->num_bits = bloom->size * 8;
+    bloom->num_hashes = MAX(1, MIN(k, BLOOM_MAX_HASHES));
+    return bloom;
+}
+
+bloom_filter_t* bloom_init_blocked(size_t expected_count, float false_positive_rate) {
+    // binary search for the max amount of entries per block, which still satisfies our false positive rate
+    float lo = 0.0f;
+    float hi = BLOOM_BLOCK_BITS / 4;  // far beyond any useful false positive rate
+    for (int i = 0; i < 24; i++) {
+        float mid = (lo + hi) / 2;
+        if (blocked_fpr(mid) <= false_positive_rate) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    uint32_t num_blocks = MAX(1, ceilf(MAX(expected_count, 1) / MAX(lo, 1.0f / BLOOM_BLOCK_BITS)));
+
+    bloom_filter_t* bloom = bloom_alloc(num_blocks * BLOOM_BLOCK_BITS / 8);
+    if (!bloom) {
+        return NULL;
+    }
+    bloom->type = BLOOM_TYPE_BLOCKED;
+    bloom->num_bits = num_blocks * BLOOM_BLOCK_BITS;
+    bloom->num_hashes = BLOOM_BLOCK_WORDS;
     return bloom;
 }
 
+/**
+ * Get the block of an entry and the mask of the bit for each of its words.
+ */
+static inline uint32_t* get_block_and_masks(bloom_filter_t* bloom, ENIntervalIdentifier* rpi, uint32_t* masks) {
+    uint32_t h1, h2;
+    get_base_hashes(rpi, &h1, &h2);
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; i++) {
+        masks[i] = 1u << ((h2 * block_salts[i]) >> 27);
+    }
+    return &((uint32_t*)bloom->data)[(h1 % (bloom->num_bits / BLOOM_BLOCK_BITS)) * BLOOM_BLOCK_WORDS];
+}
+
 void bloom_destroy(bloom_filter_t* bloom) {
     if (bloom) {
+        k_free(bloom->data);
         k_free(bloom);
     }
 }
 
 void bloom_add_record(bloom_filter_t* bloom, ENIntervalIdentifier* rpi) {
+    if (bloom->type == BLOOM_TYPE_BLOCKED) {
+        uint32_t masks[BLOOM_BLOCK_WORDS];
+        uint32_t* block = get_block_and_masks(bloom, rpi, masks);
+        for (int i = 0; i < BLOOM_BLOCK_WORDS; i++) {
+            block[i] |= masks[i];
+        }
+        bloom->count++;
+        return;
+    }
+
     uint8_t* data = bloom->data;
+    uint32_t h1, h2;
+    get_base_hashes(rpi, &h1, &h2);
 
-    for (int i = 0; i < sizeof(*rpi); i += 4) {
-        uint32_t hash = (rpi->b[i+3] << 24) | (rpi->b[i+2] << 16) | (rpi->b[i+1] << 8) | rpi->b[i];
-        hash %= bloom->size * 8;
+    for (int i = 0; i < bloom->num_hashes; i++) {
+        uint32_t hash = (h1 + i * h2) % bloom->num_bits;
         data[hash / 8] |= 1 << (hash % 8);
     }
+    bloom->count++;
 }
 
 bool bloom_probably_has_record(bloom_filter_t* bloom, ENIntervalIdentifier* rpi) {
+    if (bloom->type == BLOOM_TYPE_BLOCKED) {
+        uint32_t masks[BLOOM_BLOCK_WORDS];
+        uint32_t* block = get_block_and_masks(bloom, rpi, masks);
+        uint32_t missing = 0;
+        for (int i = 0; i < BLOOM_BLOCK_WORDS; i++) {
+            missing |= masks[i] & ~block[i];
+        }
+        return !missing;
+    }
+
     uint8_t* data = bloom->data;
-    for (int i = 0; i < sizeof(*rpi); i += 4) {
-        uint32_t hash = (rpi->b[i+3] << 24) | (rpi->b[i+2] << 16) | (rpi->b[i+1] << 8) | rpi->b[i];
-        hash %= bloom->size * 8;
+    uint32_t h1, h2;
+    get_base_hashes(rpi, &h1, &h2);
+
+    for (int i = 0; i < bloom->num_hashes; i++) {
+        uint32_t hash = (h1 + i * h2) % bloom->num_bits;
         if (!(data[hash / 8] & (1 << (hash % 8)))) {
             return false;
         }
     }
     return true;
-}
\ No newline at end of file
+}
+
+float bloom_estimate_fpr(bloom_filter_t* bloom) {
+    if (bloom->type == BLOOM_TYPE_BLOCKED) {
+        return blocked_fpr((float)bloom->count / (bloom->num_bits / BLOOM_BLOCK_BITS));
+    }
+
+    // (1 - e^(-k * n / m))^k
+    float k = bloom->num_hashes;
+    return powf(1.0f - expf(-k * bloom->count / bloom->num_bits), k);
+}
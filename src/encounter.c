@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2020 Olaf Landsiedel
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+#include <sys/printk.h>
+#include <sys/util.h>
+#include <zephyr.h>
+
+#include "encounter.h"
+
+#define SECONDS_PER_MINUTE 60
+
+static encounter_t encounters[CONFIG_ENS_ENCOUNTER_TABLE_SIZE];
+static size_t num_encounters = 0;
+
+/**
+ * Store the given encounter as a single record and remove it from our table.
+ */
+static int store_encounter(size_t index) {
+    encounter_t* encounter = &encounters[index];
+    record_t record;
+
+    int8_t rssi_mean = encounter->rssi_sum / encounter->sightings;
+    memcpy(&record.rssi, &rssi_mean, sizeof(record.rssi));
+    memcpy(&record.rssi_max, &encounter->rssi_max, sizeof(record.rssi_max));
+    record.duration = MIN((encounter->last_seen - encounter->first_seen) / SECONDS_PER_MINUTE, UINT8_MAX);
+    record.timestamp = encounter->first_seen;
+    memcpy(&record.rolling_proximity_identifier, &encounter->rolling_proximity_identifier,
+           sizeof(record.rolling_proximity_identifier));
+    memcpy(&record.associated_encrypted_metadata, &encounter->associated_encrypted_metadata,
+           sizeof(record.associated_encrypted_metadata));
+
+    int rc = add_record(&record);
+    if (rc != 0) {
+        printk("ERROR: Storing encounter failed (err %d)\n", rc);
+    }
+
+    // the last encounter fills the gap
+    num_encounters--;
+    if (index != num_encounters) {
+        memcpy(encounter, &encounters[num_encounters], sizeof(encounter_t));
+    }
+    return rc;
+}
+
+/**
+ * Check, if the encounter was first seen CONFIG_ENS_ENCOUNTER_MAX_DURATION seconds ago.
+ */
+static inline bool is_too_long(const encounter_t* encounter, uint32_t now) {
+    return (int32_t)(now - encounter->first_seen) >= CONFIG_ENS_ENCOUNTER_MAX_DURATION;
+}
+
+int encounter_add_sighting(const record_t* record) {
+    int8_t rssi;
+    memcpy(&rssi, &record->rssi, sizeof(rssi));
+
+    for (size_t i = 0; i < num_encounters; i++) {
+        encounter_t* encounter = &encounters[i];
+        if (memcmp(&encounter->rolling_proximity_identifier, &record->rolling_proximity_identifier,
+                   sizeof(ENIntervalIdentifier)) == 0) {
+            if (is_too_long(encounter, record->timestamp)) {
+                // keep the record close to its place in the storage, the sighting starts a new encounter
+                store_encounter(i);
+                break;
+            }
+            encounter->last_seen = MAX(encounter->last_seen, record->timestamp);
+            encounter->rssi_sum += rssi;
+            encounter->sightings++;
+            encounter->rssi_max = MAX(encounter->rssi_max, rssi);
+            return 0;
+        }
+    }
+
+    if (num_encounters == CONFIG_ENS_ENCOUNTER_TABLE_SIZE) {
+        // make room by storing the encounter, which was seen least recently
+        size_t oldest = 0;
+        for (size_t i = 1; i < num_encounters; i++) {
+            if (encounters[i].last_seen < encounters[oldest].last_seen) {
+                oldest = i;
+            }
+        }
+        store_encounter(oldest);
+    }
+
+    encounter_t* encounter = &encounters[num_encounters++];
+    memcpy(&encounter->rolling_proximity_identifier, &record->rolling_proximity_identifier,
+           sizeof(ENIntervalIdentifier));
+    memcpy(&encounter->associated_encrypted_metadata, &record->associated_encrypted_metadata,
+           sizeof(associated_encrypted_metadata_t));
+    encounter->first_seen = record->timestamp;
+    encounter->last_seen = record->timestamp;
+    encounter->rssi_sum = rssi;
+    encounter->sightings = 1;
+    encounter->rssi_max = rssi;
+    return 0;
+}
+
+int encounter_flush_expired(uint32_t now) {
+    int stored = 0;
+    size_t i = 0;
+    while (i < num_encounters) {
+        if (now - encounters[i].last_seen >= CONFIG_ENS_ENCOUNTER_TIMEOUT || is_too_long(&encounters[i], now)) {
+            // the last encounter is moved to index i, so we check i again
+            store_encounter(i);
+            stored++;
+        } else {
+            i++;
+        }
+    }
+    return stored;
+}
+
+int encounter_flush_all() {
+    int stored = 0;
+    while (num_encounters > 0) {
+        store_encounter(num_encounters - 1);
+        stored++;
+    }
+    return stored;
+}
@@ -0,0 +1,601 @@
+/*
+ * Copyright (c) 2020 Olaf Landsiedel
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <errno.h>
+#include <string.h>
+#include <zephyr.h>
+#include <mbedtls/platform_util.h>
+
+#include "bloom.h"
+#include "exposure_check.h"
+#include "record_bloom.h"
+#include "tracing.h"
+#include "utility/en_batch.h"
+#include "utility/en_key_cache.h"
+
+#define REVERSE_BLOOM_FALSE_POSITIVE_RATE 0.01f
+
+// amount of identifiers we derive at once with a single key schedule
+#define RPI_BATCH_SIZE 16
+
+#define JOIN_EMPTY_SLOT UINT16_MAX
+// keep the load of our table at 75%
+#define JOIN_MAX_ENTRIES (CONFIG_ENS_EXPOSURE_JOIN_TABLE_SIZE / 4 * 3)
+
+// an empty table would never make progress and slots are chosen by masking
+BUILD_ASSERT(JOIN_MAX_ENTRIES > 0, "The join table needs at least 4 entries");
+BUILD_ASSERT((CONFIG_ENS_EXPOSURE_JOIN_TABLE_SIZE & (CONFIG_ENS_EXPOSURE_JOIN_TABLE_SIZE - 1)) == 0,
+             "The size of the join table needs to be a power of 2");
+
+/**
+ * Entry of the hash join table for a single identifier.
+ */
+typedef struct join_entry {
+    uint32_t fingerprint;      // bytes 0-3 of the identifier, the slot is chosen by bytes 4-7
+    uint16_t key_index;        // JOIN_EMPTY_SLOT if unused
+    uint8_t interval_offset;   // interval relative to the rolling start of the key
+    uint8_t rsv;
+} join_entry_t;
+
+// see the heap budget of CONFIG_ENS_BLOOM_PARTITION_ENTRIES
+BUILD_ASSERT(CONFIG_ENS_EXPOSURE_JOIN_TABLE_SIZE * sizeof(join_entry_t) <= CONFIG_HEAP_MEM_POOL_SIZE / 4,
+             "The join table takes more than a quarter of the heap");
+
+// the reverse bloom filter takes about 1.33 bytes per identifier
+BUILD_ASSERT(CONFIG_ENS_EXPOSURE_REVERSE_BLOOM_ENTRIES * 4 / 3 <= CONFIG_HEAP_MEM_POOL_SIZE / 4,
+             "The reverse bloom filter takes more than a quarter of the heap");
+
+static inline uint32_t get_rolling_period(const exposure_key_t* key) {
+    return key->rolling_period ? MIN(key->rolling_period, EN_TEK_ROLLING_PERIOD) : EN_TEK_ROLLING_PERIOD;
+}
+
+/**
+ * @return the first interval within our tolerance of the given one
+ */
+static inline ENIntervalNumber get_first_tolerated(ENIntervalNumber interval) {
+    return interval > EXPOSURE_CHECK_TOLERANCE_INTERVALS ? interval - EXPOSURE_CHECK_TOLERANCE_INTERVALS : 0;
+}
+
+static inline bool is_same_rpi(const ENIntervalIdentifier* a, const ENIntervalIdentifier* b) {
+    return memcmp(a->b, b->b, sizeof(a->b)) == 0;
+}
+
+/**
+ * Check, if any stored record of the day partitions around the interval might have the identifier.
+ */
+static bool is_probably_stored(ENIntervalIdentifier* rpi, ENIntervalNumber interval) {
+    ENIntervalNumber first = get_first_tolerated(interval);
+    ENIntervalNumber last = interval + EXPOSURE_CHECK_TOLERANCE_INTERVALS;
+    for (ENIntervalNumber day = first / EN_TEK_ROLLING_PERIOD; day <= last / EN_TEK_ROLLING_PERIOD; day++) {
+        if (record_bloom_probably_has(rpi, day * EN_TEK_ROLLING_PERIOD)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Read the stored records around the interval and report the ones with the identifier.
+ */
+static int match_records_around(const exposure_key_t* key,
+                                ENIntervalIdentifier* rpi,
+                                ENIntervalNumber interval,
+                                exposure_match_cb_t cb,
+                                void* userdata) {
+    time_t start = (time_t)get_first_tolerated(interval) * EN_INTERVAL_LENGTH;
+    time_t end = (time_t)(interval + EXPOSURE_CHECK_TOLERANCE_INTERVALS + 1) * EN_INTERVAL_LENGTH - 1;
+
+    record_iterator_t iterator;
+    if (ens_records_iterator_init_timerange(&iterator, &start, &end)) {
+        return 0;
+    }
+    int matches = 0;
+    record_t* current;
+    while ((current = ens_records_iterator_next(&iterator))) {
+        if (current->timestamp >= start && current->timestamp <= end &&
+            is_same_rpi(&current->rolling_proximity_identifier, rpi)) {
+            cb(key, interval, current, userdata);
+            matches++;
+        }
+    }
+    ens_record_iterator_clear(&iterator);
+    return matches;
+}
+
+int exposure_check_init(exposure_check_ctx_t* ctx, exposure_match_cb_t cb, void* userdata) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->cb = cb;
+    ctx->userdata = userdata;
+
+    // open encounters are only in RAM, so store them first
+    if (tracing_flush_encounters()) {
+        printk("Storing open encounters timed out\n");
+    }
+
+    record_sequence_number_t oldest;
+    record_sequence_number_t latest;
+    if (get_sequence_number_interval(&oldest, &latest)) {
+        ctx->empty = true;
+        return 0;
+    }
+
+    record_t rec;
+    if (load_record(&rec, oldest)) {
+        // we cannot tell, so keep all keys
+        ctx->first_interval = 0;
+        ctx->last_interval = UINT32_MAX - EXPOSURE_CHECK_TOLERANCE_INTERVALS;
+        return 0;
+    }
+    // records are only sorted by timestamp up to RECORD_MAX_APPEND_DELAY
+    uint32_t first = rec.timestamp > RECORD_MAX_APPEND_DELAY ? rec.timestamp - RECORD_MAX_APPEND_DELAY : 0;
+    // the latest sn is not used for the very first record
+    uint32_t last = load_record(&rec, latest) == 0 ? rec.timestamp : first;
+    ctx->first_interval = en_get_interval_number(first);
+    ctx->last_interval = en_get_interval_number(last + RECORD_MAX_APPEND_DELAY);
+    return 0;
+}
+
+/**
+ * Check, if any bit from first to last (inclusive) is set.
+ */
+static bool has_any_bit(const uint8_t* bitmap, uint32_t first, uint32_t last) {
+    for (uint32_t i = first; i <= last; i++) {
+        if (bitmap[i / 8] & (1 << (i % 8))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Derive the identifiers of up to RPI_BATCH_SIZE intervals of a key at once and match them against our records.
+ *
+ * @return the amount of matches or a negative error code
+ */
+static int match_intervals(exposure_check_ctx_t* ctx,
+                           const exposure_key_t* key,
+                           en_key_context_t* derived_keys,
+                           const ENIntervalNumber* intervals,
+                           size_t count) {
+    ENIntervalIdentifier rpis[RPI_BATCH_SIZE];
+    if (en_batch_derive_with_key(rpis, &derived_keys->rpi_key, 0, intervals, count)) {
+        return -EIO;
+    }
+    ctx->derived += count;
+
+    int matches = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (is_probably_stored(&rpis[i], intervals[i])) {
+            matches += match_records_around(key, &rpis[i], intervals[i], ctx->cb, ctx->userdata);
+        }
+    }
+    return matches;
+}
+
+int exposure_check_process_key(exposure_check_ctx_t* ctx, const exposure_key_t* key) {
+    ENIntervalNumber start = key->rolling_start_interval_number;
+    uint32_t period = get_rolling_period(key);
+    ctx->keys++;
+
+    // records are not strictly ordered by time, but within our tolerance
+    if (ctx->empty || start + period - 1 + EXPOSURE_CHECK_TOLERANCE_INTERVALS < ctx->first_interval ||
+        start > ctx->last_interval + EXPOSURE_CHECK_TOLERANCE_INTERVALS) {
+        ctx->skipped_keys++;
+        return 0;
+    }
+
+    // the intervals with stored records within our tolerance of the key
+    uint8_t bitmap[(EN_TEK_ROLLING_PERIOD + 2 * EXPOSURE_CHECK_TOLERANCE_INTERVALS + 7) / 8];
+    ENIntervalNumber window_start = get_first_tolerated(start);
+    uint32_t window_length = start - window_start + period + EXPOSURE_CHECK_TOLERANCE_INTERVALS;
+    record_bloom_get_intervals(window_start, window_length, bitmap);
+
+    en_key_context_t* derived_keys = NULL;
+    ENIntervalNumber pending[RPI_BATCH_SIZE];
+    size_t pending_count = 0;
+    int matches = 0;
+    for (ENIntervalNumber interval = start; interval < start + period; interval++) {
+        if (!has_any_bit(bitmap, get_first_tolerated(interval) - window_start,
+                         interval + EXPOSURE_CHECK_TOLERANCE_INTERVALS - window_start)) {
+            continue;
+        }
+        if (!derived_keys) {
+            derived_keys = en_key_cache_get(&key->key);
+            if (!derived_keys) {
+                return -EIO;
+            }
+        }
+
+        pending[pending_count++] = interval;
+        if (pending_count == RPI_BATCH_SIZE) {
+            int rc = match_intervals(ctx, key, derived_keys, pending, pending_count);
+            if (rc < 0) {
+                return rc;
+            }
+            matches += rc;
+            pending_count = 0;
+        }
+    }
+
+    if (pending_count) {
+        int rc = match_intervals(ctx, key, derived_keys, pending, pending_count);
+        if (rc < 0) {
+            return rc;
+        }
+        matches += rc;
+    }
+    if (!derived_keys) {
+        ctx->skipped_keys++;
+    }
+    return matches;
+}
+
+int exposure_check_on_exported_key(const exposure_key_t* key, void* userdata) {
+    int rc = exposure_check_process_key((exposure_check_ctx_t*)userdata, key);
+    return rc < 0 ? rc : 0;
+}
+
+int exposure_check_forward(const exposure_key_t* keys, size_t count, exposure_match_cb_t cb, void* userdata) {
+    exposure_check_ctx_t ctx;
+    int rc = exposure_check_init(&ctx, cb, userdata);
+    if (rc) {
+        return rc;
+    }
+
+    int matches = 0;
+    for (size_t i = 0; i < count; i++) {
+        rc = exposure_check_process_key(&ctx, &keys[i]);
+        if (rc < 0) {
+            return rc;
+        }
+        matches += rc;
+    }
+    return matches;
+}
+
+/**
+ * Expand the period identifier key of a TEK. The bulk checks use each key only once per pass, so they set up their
+ * key schedules themselves instead of cycling through the key cache.
+ *
+ * @param key the key schedule to set up, needs to be cleared with en_batch_key_clear afterwards
+ * @return 0 on success
+ */
+static int setup_key(en_batch_key_t* key, const ENPeriodKey* tek) {
+    ENPeriodIdentifierKey pik;
+    en_derive_period_identifier_key(&pik, tek);
+    int rc = en_batch_key_setup(key, &pik);
+    mbedtls_platform_zeroize(&pik, sizeof(pik));
+    return rc;
+}
+
+/**
+ * Check a record against all keys, which were valid around its timestamp.
+ *
+ * @param piks the period identifier keys of the keys
+ * @return the amount of matches or -EIO, if the identifiers could not be derived
+ */
+static int match_keys(const exposure_key_t* keys,
+                      const ENPeriodIdentifierKey* piks,
+                      size_t count,
+                      record_t* record,
+                      exposure_match_cb_t cb,
+                      void* userdata) {
+    ENIntervalNumber interval = en_get_interval_number(record->timestamp);
+    ENIntervalNumber first = get_first_tolerated(interval);
+    ENIntervalNumber last = interval + EXPOSURE_CHECK_TOLERANCE_INTERVALS;
+
+    int matches = 0;
+    for (size_t i = 0; i < count; i++) {
+        ENIntervalNumber key_first = MAX(first, keys[i].rolling_start_interval_number);
+        ENIntervalNumber key_last =
+            MIN(last, keys[i].rolling_start_interval_number + get_rolling_period(&keys[i]) - 1);
+        if (key_first > key_last) {
+            continue;
+        }
+
+        en_batch_key_t rpi_key;
+        if (en_batch_key_setup(&rpi_key, &piks[i])) {
+            return -EIO;
+        }
+        int rc = 0;
+        for (ENIntervalNumber j = key_first; j <= key_last; j += RPI_BATCH_SIZE) {
+            ENIntervalIdentifier rpis[RPI_BATCH_SIZE];
+            size_t n = MIN(RPI_BATCH_SIZE, key_last - j + 1);
+            if (en_batch_derive_with_key(rpis, &rpi_key, j, NULL, n)) {
+                rc = -EIO;
+                break;
+            }
+            size_t k = 0;
+            while (k < n && !is_same_rpi(&record->rolling_proximity_identifier, &rpis[k])) {
+                k++;
+            }
+            if (k < n) {
+                cb(&keys[i], j + k, record, userdata);
+                matches++;
+                break;
+            }
+        }
+        en_batch_key_clear(&rpi_key);
+        if (rc) {
+            return rc;
+        }
+    }
+    return matches;
+}
+
+/**
+ * Add all identifiers of the keys to the filter. The period identifier keys are kept, so hits only need the AES key
+ * setup of each key.
+ *
+ * @return 0 on success, -EIO if the identifiers could not be derived
+ */
+static int fill_reverse_bloom(bloom_filter_t* bloom,
+                              const exposure_key_t* keys,
+                              ENPeriodIdentifierKey* piks,
+                              size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        en_derive_period_identifier_key(&piks[i], &keys[i].key);
+        en_batch_key_t rpi_key;
+        if (en_batch_key_setup(&rpi_key, &piks[i])) {
+            return -EIO;
+        }
+        uint32_t period = get_rolling_period(&keys[i]);
+        int rc = 0;
+        for (uint32_t j = 0; j < period && !rc; j += RPI_BATCH_SIZE) {
+            ENIntervalIdentifier rpis[RPI_BATCH_SIZE];
+            size_t n = MIN(RPI_BATCH_SIZE, period - j);
+            rc = en_batch_derive_with_key(rpis, &rpi_key, keys[i].rolling_start_interval_number + j, NULL, n);
+            for (size_t k = 0; k < n && !rc; k++) {
+                bloom_add_record(bloom, &rpis[k]);
+            }
+        }
+        en_batch_key_clear(&rpi_key);
+        if (rc) {
+            return -EIO;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Check the keys, whose identifiers fit into a single filter, in one pass over our stored records.
+ *
+ * @param total the amount of identifiers of the keys
+ * @return the amount of matches, negative on error
+ */
+static int check_reverse_pass(const exposure_key_t* keys,
+                              size_t count,
+                              size_t total,
+                              exposure_match_cb_t cb,
+                              void* userdata) {
+    bloom_filter_t* bloom = bloom_init_blocked(total, REVERSE_BLOOM_FALSE_POSITIVE_RATE);
+    ENPeriodIdentifierKey* piks = k_malloc(count * sizeof(ENPeriodIdentifierKey));
+    int matches = 0;
+    if (!bloom || !piks) {
+        matches = -ENOMEM;
+        goto end;
+    }
+
+    int rc = fill_reverse_bloom(bloom, keys, piks, count);
+    if (rc) {
+        matches = rc;
+        goto end;
+    }
+
+    record_iterator_t iterator;
+    rc = ens_records_iterator_init_range(&iterator, NULL, NULL);
+    if (rc) {
+        matches = rc;
+        goto end;
+    }
+    record_t* current;
+    while ((current = ens_records_iterator_next(&iterator))) {
+        if (bloom_probably_has_record(bloom, &current->rolling_proximity_identifier)) {
+            rc = match_keys(keys, piks, count, current, cb, userdata);
+            if (rc < 0) {
+                matches = rc;
+                break;
+            }
+            matches += rc;
+        }
+    }
+    ens_record_iterator_clear(&iterator);
+
+end:
+    if (piks) {
+        mbedtls_platform_zeroize(piks, count * sizeof(ENPeriodIdentifierKey));
+        k_free(piks);
+    }
+    bloom_destroy(bloom);
+    return matches;
+}
+
+int exposure_check_reverse(const exposure_key_t* keys, size_t count, exposure_match_cb_t cb, void* userdata) {
+    int matches = 0;
+    size_t done = 0;
+    while (done < count) {
+        // as many keys as fit into our filter, but at least one
+        size_t pass_count = 0;
+        size_t total = 0;
+        while (done + pass_count < count) {
+            uint32_t period = get_rolling_period(&keys[done + pass_count]);
+            if (pass_count > 0 && total + period > CONFIG_ENS_EXPOSURE_REVERSE_BLOOM_ENTRIES) {
+                break;
+            }
+            total += period;
+            pass_count++;
+        }
+
+        int rc = check_reverse_pass(&keys[done], pass_count, total, cb, userdata);
+        if (rc < 0) {
+            return rc;
+        }
+        matches += rc;
+        done += pass_count;
+    }
+    return matches;
+}
+
+static inline uint32_t get_fingerprint(const ENIntervalIdentifier* rpi) {
+    return rpi->b[0] | (rpi->b[1] << 8) | (rpi->b[2] << 16) | ((uint32_t)rpi->b[3] << 24);
+}
+
+static inline uint32_t get_slot(const ENIntervalIdentifier* rpi) {
+    uint32_t hash = rpi->b[4] | (rpi->b[5] << 8) | (rpi->b[6] << 16) | ((uint32_t)rpi->b[7] << 24);
+    return hash & (CONFIG_ENS_EXPOSURE_JOIN_TABLE_SIZE - 1);
+}
+
+/**
+ * Add all identifiers of the keys to the table, starting at the given interval offset of the first key.
+ *
+ * @return the amount of keys, whose identifiers were all added, or -EIO, if the identifiers could not be derived
+ */
+static int fill_join_table(join_entry_t* table,
+                              const exposure_key_t* keys,
+                              size_t count,
+                              uint32_t* first_offset) {
+    memset(table, 0xff, CONFIG_ENS_EXPOSURE_JOIN_TABLE_SIZE * sizeof(join_entry_t));
+    uint32_t entries = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t period = get_rolling_period(&keys[i]);
+        uint32_t j = i == 0 ? *first_offset : 0;
+        if (j < period && entries == JOIN_MAX_ENTRIES) {
+            // continue with this key in the next pass
+            *first_offset = j;
+            return i;
+        }
+        en_batch_key_t rpi_key;
+        if (setup_key(&rpi_key, &keys[i].key)) {
+            return -EIO;
+        }
+        while (j < period) {
+            if (entries == JOIN_MAX_ENTRIES) {
+                // continue with this identifier in the next pass
+                en_batch_key_clear(&rpi_key);
+                *first_offset = j;
+                return i;
+            }
+            ENIntervalIdentifier rpis[RPI_BATCH_SIZE];
+            size_t n = MIN(MIN(RPI_BATCH_SIZE, period - j), JOIN_MAX_ENTRIES - entries);
+            ENIntervalNumber interval = keys[i].rolling_start_interval_number + j;
+            if (en_batch_derive_with_key(rpis, &rpi_key, interval, NULL, n)) {
+                en_batch_key_clear(&rpi_key);
+                return -EIO;
+            }
+
+            for (size_t k = 0; k < n; k++, j++) {
+                uint32_t slot = get_slot(&rpis[k]);
+                while (table[slot].key_index != JOIN_EMPTY_SLOT) {
+                    slot = (slot + 1) & (CONFIG_ENS_EXPOSURE_JOIN_TABLE_SIZE - 1);
+                }
+                table[slot].fingerprint = get_fingerprint(&rpis[k]);
+                table[slot].key_index = i;
+                table[slot].interval_offset = j;
+                entries++;
+            }
+        }
+    }
+    *first_offset = 0;
+    return count;
+}
+
+/**
+ * Look up a record in the table and report all exact matches within our tolerance.
+ *
+ * @return the amount of matches or -EIO, if the identifiers could not be derived
+ */
+static int probe_join_table(const join_entry_t* table,
+                            const exposure_key_t* keys,
+                            record_t* record,
+                            exposure_match_cb_t cb,
+                            void* userdata) {
+    ENIntervalNumber record_interval = en_get_interval_number(record->timestamp);
+    uint32_t fingerprint = get_fingerprint(&record->rolling_proximity_identifier);
+
+    int matches = 0;
+    for (uint32_t slot = get_slot(&record->rolling_proximity_identifier); table[slot].key_index != JOIN_EMPTY_SLOT;
+         slot = (slot + 1) & (CONFIG_ENS_EXPOSURE_JOIN_TABLE_SIZE - 1)) {
+        if (table[slot].fingerprint != fingerprint) {
+            continue;
+        }
+        const exposure_key_t* key = &keys[table[slot].key_index];
+        ENIntervalNumber interval = key->rolling_start_interval_number + table[slot].interval_offset;
+        if (interval + EXPOSURE_CHECK_TOLERANCE_INTERVALS < record_interval ||
+            interval > record_interval + EXPOSURE_CHECK_TOLERANCE_INTERVALS) {
+            continue;
+        }
+
+        // the fingerprint matches, so derive the whole identifier
+        en_batch_key_t rpi_key;
+        ENIntervalIdentifier rpi;
+        if (setup_key(&rpi_key, &key->key)) {
+            return -EIO;
+        }
+        int rc = en_batch_derive_with_key(&rpi, &rpi_key, interval, NULL, 1);
+        en_batch_key_clear(&rpi_key);
+        if (rc) {
+            return -EIO;
+        }
+        if (is_same_rpi(&record->rolling_proximity_identifier, &rpi)) {
+            cb(key, interval, record, userdata);
+            matches++;
+        }
+    }
+    return matches;
+}
+
+int exposure_check_hash_join(const exposure_key_t* keys, size_t count, exposure_match_cb_t cb, void* userdata) {
+    join_entry_t* table = k_malloc(CONFIG_ENS_EXPOSURE_JOIN_TABLE_SIZE * sizeof(join_entry_t));
+    if (!table) {
+        return -ENOMEM;
+    }
+
+    int matches = 0;
+    size_t done = 0;
+    uint32_t first_offset = 0;
+    while (done < count) {
+        // a key might be split over two passes, so its first offset tells where to continue
+        const exposure_key_t* batch = &keys[done];
+        int filled = fill_join_table(table, batch, count - done, &first_offset);
+        if (filled < 0) {
+            matches = filled;
+            break;
+        }
+
+        record_iterator_t iterator;
+        int rc = ens_records_iterator_init_range(&iterator, NULL, NULL);
+        if (rc) {
+            matches = rc;
+            break;
+        }
+        record_t* current;
+        while ((current = ens_records_iterator_next(&iterator))) {
+            rc = probe_join_table(table, batch, current, cb, userdata);
+            if (rc < 0) {
+                break;
+            }
+            matches += rc;
+        }
+        ens_record_iterator_clear(&iterator);
+        if (rc < 0) {
+            matches = rc;
+            break;
+        }
+        done += filled;
+    }
+
+    k_free(table);
+    return matches;
+}
+
+int exposure_check(const exposure_key_t* keys, size_t count, exposure_match_cb_t cb, void* userdata) {
+#if CONFIG_CONTACTS_HASH_JOIN
+    return exposure_check_hash_join(keys, count, cb, userdata);
+#elif CONFIG_CONTACTS_BLOOM_REVERSE
+    return exposure_check_reverse(keys, count, cb, userdata);
+#else
+    return exposure_check_forward(keys, count, cb, userdata);
+#endif
+}
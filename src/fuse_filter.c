@@ -0,0 +1,265 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr.h>
+
+#include "fuse_filter.h"
+
+/**
+ * Binary fuse filter with three hashes, following Graf and Lemire, "Binary Fuse Filters: Fast and Smaller Than Xor
+ * Filters". The construction is adapted to small devices: keys are 32-bit and peeled via their 16-bit index instead
+ * of their 64-bit hash, the fingerprints of the filter serve as slot counters and the peeling order shares its buffer
+ * with the queue of slots to peel. It needs 4 bytes per slot besides the filter itself.
+ */
+
+#define FUSE_ARITY 3
+#define FUSE_MAX_ITERATIONS 100
+#define FUSE_MAX_SEGMENT_LENGTH 262144
+
+static uint64_t murmur64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t splitmix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * Upper 64 bits of a * b for b < 2^32, without 128-bit arithmetic.
+ */
+static inline uint32_t mulhi(uint64_t a, uint32_t b) {
+    return (uint32_t)(((a >> 32) * b + (((a & 0xffffffff) * b) >> 32)) >> 32);
+}
+
+static inline uint64_t get_hash(const fuse_filter_t* filter, uint32_t key) {
+    return murmur64(key + filter->seed);
+}
+
+static inline uint8_t get_fingerprint(uint64_t hash) {
+    return (uint8_t)(hash ^ (hash >> 32));
+}
+
+/**
+ * Get the three slots of a hash, one in each of three consecutive segments.
+ */
+static inline void get_slots(const fuse_filter_t* filter, uint64_t hash, uint32_t* slots) {
+    uint32_t mask = filter->segment_length - 1;
+    slots[0] = mulhi(hash, filter->segment_count_length);
+    slots[1] = (slots[0] + filter->segment_length) ^ ((hash >> 18) & mask);
+    slots[2] = (slots[0] + 2 * filter->segment_length) ^ (hash & mask);
+}
+
+/**
+ * Get the segment length and the amount of segments, the first fingerprint of a key can be in.
+ */
+static void get_geometry(uint32_t count, uint32_t* segment_length, uint32_t* segment_count) {
+    // segment length and size factor as suggested by the paper
+    *segment_length = count == 0 ? 4 : 1u << (int)(floor(log(count) / log(3.33) + 2.25));
+    *segment_length = MIN(*segment_length, FUSE_MAX_SEGMENT_LENGTH);
+    double size_factor = count <= 1 ? 0 : MAX(1.125, 0.875 + 0.25 * log(1000000.0) / log(count));
+    uint32_t capacity = (uint32_t)round(count * size_factor);
+
+    *segment_count = (capacity + *segment_length - 1) / *segment_length;
+    *segment_count = *segment_count <= FUSE_ARITY - 1 ? 1 : *segment_count - (FUSE_ARITY - 1);
+}
+
+uint32_t fuse_filter_size(uint32_t count) {
+    uint32_t segment_length;
+    uint32_t segment_count;
+    get_geometry(count, &segment_length, &segment_count);
+    return (segment_count + FUSE_ARITY - 1) * segment_length;
+}
+
+fuse_filter_t* fuse_filter_init(uint32_t count) {
+    fuse_filter_t* filter = k_calloc(1, sizeof(fuse_filter_t));
+    if (!filter) {
+        return NULL;
+    }
+    filter->count = count;
+
+    uint32_t segment_length;
+    uint32_t segment_count;
+    get_geometry(count, &segment_length, &segment_count);
+    filter->segment_length = segment_length;
+    filter->segment_count_length = segment_count * segment_length;
+    filter->array_length = (segment_count + FUSE_ARITY - 1) * segment_length;
+    filter->fingerprints = k_calloc(filter->array_length, 1);
+    if (!filter->fingerprints) {
+        k_free(filter);
+        return NULL;
+    }
+    return filter;
+}
+
+void fuse_filter_destroy(fuse_filter_t* filter) {
+    k_free(filter->fingerprints);
+    k_free(filter);
+}
+
+static int compare_keys(const void* a, const void* b) {
+    uint32_t ka = *(const uint32_t*)a;
+    uint32_t kb = *(const uint32_t*)b;
+    return ka < kb ? -1 : ka > kb;
+}
+
+/**
+ * Remove duplicates from the keys.
+ *
+ * @return the amount of unique keys
+ */
+static uint32_t unique_keys(uint32_t* keys, uint32_t count) {
+    if (count == 0) {
+        return 0;
+    }
+    qsort(keys, count, sizeof(uint32_t), compare_keys);
+    uint32_t unique = 1;
+    for (uint32_t i = 1; i < count; i++) {
+        if (keys[i] != keys[unique - 1]) {
+            keys[unique++] = keys[i];
+        }
+    }
+    return unique;
+}
+
+/**
+ * Try to find an order, in which each key has a slot not used by any of the keys after it.
+ *
+ * Each slot tracks the amount of its keys (times 4), which of the three slots of these keys it is (xor-ed in the
+ * lower two bits) and the xor of their indices. A slot with a single key therefore directly gives its key.
+ *
+ * A slot is queued at most once, as its amount of keys never increases, and leaves the queue before it is peeled. So
+ * the peeled slots fill the stack from the front and the queued slots from the back, without ever meeting.
+ *
+ * @param slot_count the amount of keys per slot, array_length bytes
+ * @param slot_xor the xor of the key indices per slot, array_length entries
+ * @param stack the order of the peeled slots, array_length entries
+ * @return true, if all keys could be peeled
+ */
+static bool peel(const fuse_filter_t* filter,
+                 const uint32_t* keys,
+                 uint8_t* slot_count,
+                 uint16_t* slot_xor,
+                 uint16_t* stack) {
+    uint32_t length = filter->array_length;
+    uint32_t slots[FUSE_ARITY];
+    memset(slot_count, 0, length);
+    memset(slot_xor, 0, length * sizeof(uint16_t));
+
+    for (uint32_t i = 0; i < filter->count; i++) {
+        get_slots(filter, get_hash(filter, keys[i]), slots);
+        for (int j = 0; j < FUSE_ARITY; j++) {
+            if (slot_count[slots[j]] >= 252) {
+                // too many keys in a slot, try another seed
+                return false;
+            }
+            slot_count[slots[j]] = (slot_count[slots[j]] + 4) ^ j;
+            slot_xor[slots[j]] ^= i;
+        }
+    }
+
+    uint32_t queued = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        if ((slot_count[i] >> 2) == 1) {
+            stack[length - 1 - queued++] = i;
+        }
+    }
+
+    uint32_t peeled = 0;
+    while (queued > 0) {
+        uint16_t slot = stack[length - queued];
+        queued--;
+        if ((slot_count[slot] >> 2) != 1) {
+            continue;
+        }
+        // the slot keeps the index of its key for the assignment
+        uint16_t key_index = slot_xor[slot];
+        uint8_t found = slot_count[slot] & 3;
+        stack[peeled++] = slot;
+
+        // remove the key from its other slots
+        get_slots(filter, get_hash(filter, keys[key_index]), slots);
+        for (int j = 0; j < FUSE_ARITY; j++) {
+            if (j == found) {
+                continue;
+            }
+            uint32_t other = slots[j];
+            if ((slot_count[other] >> 2) == 2) {
+                stack[length - 1 - queued++] = other;
+            }
+            slot_count[other] = (slot_count[other] - 4) ^ j;
+            slot_xor[other] ^= key_index;
+        }
+        slot_count[slot] = 0;
+    }
+    return peeled == filter->count;
+}
+
+fuse_filter_t* fuse_filter_build(uint32_t* keys, uint32_t count) {
+    if (count > FUSE_FILTER_MAX_KEYS) {
+        return NULL;
+    }
+    count = unique_keys(keys, count);
+
+    fuse_filter_t* filter = fuse_filter_init(count);
+    if (!filter) {
+        return NULL;
+    }
+
+    uint32_t length = filter->array_length;
+    uint16_t* slot_xor = k_malloc(length * sizeof(uint16_t));
+    uint16_t* stack = k_malloc(length * sizeof(uint16_t));
+
+    bool success = false;
+    if (slot_xor && stack) {
+        uint64_t state = 0x726b2b9d438b9d4dULL;
+        for (int i = 0; i < FUSE_MAX_ITERATIONS && !success; i++) {
+            filter->seed = splitmix64(&state);
+            // the fingerprints are not needed until the assignment
+            success = peel(filter, keys, filter->fingerprints, slot_xor, stack);
+        }
+    }
+
+    if (success) {
+        // assign in reverse order, the slot of each key is not used by any key assigned before
+        memset(filter->fingerprints, 0, length);
+        uint32_t slots[FUSE_ARITY];
+        for (int32_t i = (int32_t)count - 1; i >= 0; i--) {
+            uint16_t slot = stack[i];
+            uint64_t hash = get_hash(filter, keys[slot_xor[slot]]);
+            get_slots(filter, hash, slots);
+            // the slots of a key are in different segments
+            uint8_t found = slots[0] == slot ? 0 : slots[1] == slot ? 1 : 2;
+            filter->fingerprints[slot] = get_fingerprint(hash) ^
+                                         filter->fingerprints[slots[(found + 1) % FUSE_ARITY]] ^
+                                         filter->fingerprints[slots[(found + 2) % FUSE_ARITY]];
+        }
+    }
+
+    k_free(slot_xor);
+    k_free(stack);
+
+    if (!success) {
+        fuse_filter_destroy(filter);
+        return NULL;
+    }
+    return filter;
+}
+
+bool fuse_filter_contains(const fuse_filter_t* filter, uint32_t key) {
+    if (filter->count == 0) {
+        return false;
+    }
+    uint64_t hash = get_hash(filter, key);
+    uint32_t slots[FUSE_ARITY];
+    get_slots(filter, hash, slots);
+    return (get_fingerprint(hash) ^ filter->fingerprints[slots[0]] ^ filter->fingerprints[slots[1]] ^
+            filter->fingerprints[slots[2]]) == 0;
+}
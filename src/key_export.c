@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2020 Olaf Landsiedel
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <errno.h>
+#include <string.h>
+#include <zephyr.h>
+
+#include "export.pb-c.h"
+#include "key_export.h"
+#include "utility/pb_arena.h"
+
+enum decoder_state {
+    STATE_HEADER,
+    STATE_TAG,
+    STATE_VARINT,  // value of a varint field, which we do not need
+    STATE_LENGTH,
+    STATE_SKIP,  // remaining bytes of a field, which we do not need
+    STATE_KEY,   // remaining bytes of a key message
+};
+
+#define WIRE_VARINT 0
+#define WIRE_FIXED64 1
+#define WIRE_LENGTH_DELIMITED 2
+#define WIRE_FIXED32 5
+
+// field numbers of TemporaryExposureKeyExport and TemporaryExposureKey
+#define EXPORT_FIELD_KEYS 7
+#define KEY_FIELD_KEY_DATA 1
+#define KEY_FIELD_TRANSMISSION_RISK_LEVEL 2
+#define KEY_FIELD_ROLLING_START_INTERVAL_NUMBER 3
+#define KEY_FIELD_ROLLING_PERIOD 4
+#define KEY_FIELD_REPORT_TYPE 5
+#define KEY_FIELD_DAYS_SINCE_ONSET_OF_SYMPTOMS 6
+
+static int read_varint(const uint8_t** pos, const uint8_t* end, uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*pos == end) {
+            return -EINVAL;
+        }
+        uint8_t byte = *(*pos)++;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+
+// a single byte tag of the given field
+#define KEY_TAG(field, wire_type) (((field) << 3) | (wire_type))
+
+int key_export_parse_key(const uint8_t* message, size_t size, key_export_key_view_t* view) {
+    const uint8_t* pos = message;
+    const uint8_t* end = message + size;
+
+    memset(view, 0, sizeof(*view));
+    while (pos < end) {
+        uint64_t value;
+        // all fields of the schema have numbers below 16, so their tags take a single byte
+        uint8_t tag = *pos++;
+        switch (tag) {
+            case KEY_TAG(KEY_FIELD_KEY_DATA, WIRE_LENGTH_DELIMITED):
+                if (end - pos < 1 + sizeof(ENPeriodKey) || *pos != sizeof(ENPeriodKey)) {
+                    return -ENOTSUP;
+                }
+                view->key_data = pos + 1;
+                pos += 1 + sizeof(ENPeriodKey);
+                break;
+            case KEY_TAG(KEY_FIELD_ROLLING_START_INTERVAL_NUMBER, WIRE_VARINT):
+            case KEY_TAG(KEY_FIELD_ROLLING_PERIOD, WIRE_VARINT):
+            case KEY_TAG(KEY_FIELD_TRANSMISSION_RISK_LEVEL, WIRE_VARINT):
+            case KEY_TAG(KEY_FIELD_REPORT_TYPE, WIRE_VARINT):
+            case KEY_TAG(KEY_FIELD_DAYS_SINCE_ONSET_OF_SYMPTOMS, WIRE_VARINT):
+                // negative values are left to protobuf-c, which truncates them to int32
+                if (read_varint(&pos, end, &value) || value > INT32_MAX) {
+                    return -ENOTSUP;
+                }
+                if (tag == KEY_TAG(KEY_FIELD_ROLLING_START_INTERVAL_NUMBER, WIRE_VARINT)) {
+                    view->rolling_start_interval_number = value;
+                } else if (tag == KEY_TAG(KEY_FIELD_ROLLING_PERIOD, WIRE_VARINT)) {
+                    view->rolling_period = value;
+                }
+                break;
+            default:
+                return -ENOTSUP;
+        }
+    }
+    return view->key_data ? 0 : -EINVAL;
+}
+
+int key_export_unpack_key_protobuf(const uint8_t* message, size_t size, exposure_key_t* key) {
+    uint64_t buffer[PB_ARENA_SIZE_FOR(KEY_EXPORT_MAX_KEY_SIZE) / sizeof(uint64_t)];
+    pb_arena_t arena;
+
+    if (size > KEY_EXPORT_MAX_KEY_SIZE) {
+        return -EINVAL;
+    }
+    pb_arena_init(&arena, buffer, sizeof(buffer));
+    TemporaryExposureKey* unpacked = temporary_exposure_key__unpack(&arena.allocator, size, message);
+    if (!unpacked || !unpacked->has_key_data || unpacked->key_data.len != sizeof(key->key.b)) {
+        return -EINVAL;
+    }
+
+    // the arena lives on the stack, so there is nothing to free
+    memset(key, 0, sizeof(*key));
+    memcpy(key->key.b, unpacked->key_data.data, sizeof(key->key.b));
+    key->rolling_start_interval_number = unpacked->rolling_start_interval_number;
+    key->rolling_period = unpacked->has_rolling_period ? unpacked->rolling_period : 0;
+    return 0;
+}
+
+int key_export_unpack_key(const uint8_t* message, size_t size, exposure_key_t* key) {
+    key_export_key_view_t view;
+    int rc = key_export_parse_key(message, size, &view);
+    if (rc == -ENOTSUP) {
+        return key_export_unpack_key_protobuf(message, size, key);
+    }
+    if (rc) {
+        return rc;
+    }
+
+    memset(key, 0, sizeof(*key));
+    memcpy(key->key.b, view.key_data, sizeof(key->key.b));
+    key->rolling_start_interval_number = view.rolling_start_interval_number;
+    key->rolling_period = view.rolling_period;
+    return 0;
+}
+
+static inline void start_varint(key_export_decoder_t* decoder, enum decoder_state state) {
+    decoder->state = state;
+    decoder->varint = 0;
+    decoder->varint_shift = 0;
+}
+
+/**
+ * Add the next byte to the current varint.
+ *
+ * @return 1 if the varint is complete, 0 if more bytes follow, -EINVAL if it is too long
+ */
+static int add_varint_byte(key_export_decoder_t* decoder, uint8_t byte) {
+    if (decoder->varint_shift >= 64) {
+        return -EINVAL;
+    }
+    decoder->varint |= (uint64_t)(byte & 0x7f) << decoder->varint_shift;
+    decoder->varint_shift += 7;
+    return !(byte & 0x80);
+}
+
+/**
+ * Continue after a complete tag of a top level field.
+ */
+static int on_tag(key_export_decoder_t* decoder) {
+    decoder->field = decoder->varint >> 3;
+    decoder->wire_type = decoder->varint & 0x7;
+    if (decoder->field == 0) {
+        return -EINVAL;
+    }
+
+    switch (decoder->wire_type) {
+        case WIRE_VARINT:
+            start_varint(decoder, STATE_VARINT);
+            return 0;
+        case WIRE_LENGTH_DELIMITED:
+            start_varint(decoder, STATE_LENGTH);
+            return 0;
+        case WIRE_FIXED64:
+        case WIRE_FIXED32:
+            decoder->state = STATE_SKIP;
+            decoder->remaining = decoder->wire_type == WIRE_FIXED64 ? 8 : 4;
+            return 0;
+        default:
+            // groups are not part of the format
+            return -EINVAL;
+    }
+}
+
+/**
+ * Continue after the length of a length delimited top level field.
+ */
+static int on_length(key_export_decoder_t* decoder) {
+    if (decoder->varint > UINT32_MAX) {
+        return -EINVAL;
+    }
+    decoder->remaining = decoder->varint;
+    decoder->state = STATE_SKIP;
+    if (decoder->field == EXPORT_FIELD_KEYS) {
+        if (decoder->remaining <= KEY_EXPORT_MAX_KEY_SIZE) {
+            decoder->state = STATE_KEY;
+            decoder->offset = 0;
+        } else {
+            decoder->invalid_keys++;
+        }
+    }
+    if (decoder->remaining == 0) {
+        if (decoder->state == STATE_KEY) {
+            decoder->invalid_keys++;
+        }
+        start_varint(decoder, STATE_TAG);
+    }
+    return 0;
+}
+
+static int on_key_message(key_export_decoder_t* decoder, const uint8_t* message, size_t size) {
+    exposure_key_t key;
+    start_varint(decoder, STATE_TAG);
+    if (key_export_unpack_key(message, size, &key)) {
+        decoder->invalid_keys++;
+        return 0;
+    }
+    decoder->keys++;
+    return decoder->cb(&key, decoder->userdata);
+}
+
+void key_export_decoder_init(key_export_decoder_t* decoder, key_export_cb_t cb, void* userdata) {
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->cb = cb;
+    decoder->userdata = userdata;
+    decoder->state = STATE_HEADER;
+}
+
+int key_export_decoder_feed(key_export_decoder_t* decoder, const uint8_t* data, size_t size) {
+    const uint8_t* end = data + size;
+    while (data < end) {
+        int rc = 0;
+        size_t n;
+        switch (decoder->state) {
+            case STATE_HEADER:
+                if (*data++ != KEY_EXPORT_HEADER[decoder->offset++]) {
+                    return -EINVAL;
+                }
+                if (decoder->offset == KEY_EXPORT_HEADER_SIZE) {
+                    start_varint(decoder, STATE_TAG);
+                }
+                break;
+            case STATE_TAG:
+                rc = add_varint_byte(decoder, *data++);
+                if (rc > 0) {
+                    rc = on_tag(decoder);
+                }
+                break;
+            case STATE_VARINT:
+                rc = add_varint_byte(decoder, *data++);
+                if (rc > 0) {
+                    start_varint(decoder, STATE_TAG);
+                    rc = 0;
+                }
+                break;
+            case STATE_LENGTH:
+                rc = add_varint_byte(decoder, *data++);
+                if (rc > 0) {
+                    rc = on_length(decoder);
+                }
+                break;
+            case STATE_SKIP:
+                n = MIN(decoder->remaining, end - data);
+                data += n;
+                decoder->remaining -= n;
+                if (decoder->remaining == 0) {
+                    start_varint(decoder, STATE_TAG);
+                }
+                break;
+            case STATE_KEY:
+                if (decoder->offset == 0 && decoder->remaining <= end - data) {
+                    // the whole message is within this chunk, parse it in place
+                    n = decoder->remaining;
+                    data += n;
+                    rc = on_key_message(decoder, data - n, n);
+                    break;
+                }
+                n = MIN(decoder->remaining, end - data);
+                memcpy(&decoder->key_message[decoder->offset], data, n);
+                data += n;
+                decoder->offset += n;
+                decoder->remaining -= n;
+                if (decoder->remaining == 0) {
+                    decoder->copied_keys++;
+                    rc = on_key_message(decoder, decoder->key_message, decoder->offset);
+                }
+                break;
+        }
+        if (rc < 0) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+int key_export_decoder_finish(key_export_decoder_t* decoder) {
+    if (decoder->state != STATE_TAG || decoder->varint_shift != 0) {
+        return -EINVAL;
+    }
+    return 0;
+}
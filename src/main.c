@@ -17,33 +17,28 @@
 #include "sync_service.h"
 #include "tracing.h"
 #include "bloom.h"
+#include "exposure_check.h"
+#include "record_bloom.h"
+#include "utility/en_batch.h"
+
+#if CONFIG_TEST_UNPACK_KEYS
+#include <timing/timing.h>
+#include "export.pb-c.h"
+#include "key_export.h"
+#endif
 
 #include "mbedtls/platform.h"
 
 
 #define BLOOM_TEST 0
 #define CLEAN_INIT (BLOOM_TEST)
+#define BLOOM_FALSE_POSITIVE_RATE 0.01f
+#define BLOOM_BENCHMARK 0
+// keep the filters well within the heap (the native_posix_64 heap is rather small)
+#define BLOOM_BENCHMARK_ENTRIES (CONFIG_HEAP_MEM_POOL_SIZE / 4)
+#define BLOOM_BENCHMARK_PROBES 16384
 
  #if BLOOM_TEST
-/**
- * Fill the bloom filter with all stored records.
- */
-void fill_bloom_with_stored_records(bloom_filter_t* bloom) {
-    // init iterator for filling bloom filter
-    record_iterator_t iterator;
-    int rc = ens_records_iterator_init_timerange(&iterator, NULL, NULL);
-    if (rc) {
-        printk("init iterator failed0 (err %d)\n", rc);
-        return;
-    }
-
-    // fill bloom filter with records
-    record_t* current;
-    while ((current = ens_records_iterator_next(&iterator))) {
-        bloom_add_record(bloom, &(current->rolling_proximity_identifier));
-    }
-}
-
 void bloom_test() {
     printk("Filling record storage...\n");
     reset_record_storage();
@@ -51,78 +46,372 @@ void bloom_test() {
     tek_t tek;
     ENPeriodIdentifierKey pik;
 
-    tek_storage_get_latest_at_ts(&tek, 0);
+    if (tek_storage_get_latest_at_ts(&tek, 0)) {
+        tek.timestamp = 0;
+        en_generate_period_key(&tek.tek);
+        tek_storage_add(&tek);
+    }
     en_derive_period_identifier_key(&pik, &tek.tek);
 
-
-    bloom_filter_t* bf = bloom_init(0); // size not used atm
-
-    /// we now fill the whole flash memory with stupid data
+    // spread the records over the days covered by our partitions, with the rpi of their interval
+    uint32_t seconds_per_record = CONFIG_ENS_BLOOM_DAYS * EN_TEK_ROLLING_PERIOD * EN_INTERVAL_LENGTH /
+                                  CONFIG_ENS_MAX_CONTACTS;
     for (int i = 0; i < CONFIG_ENS_MAX_CONTACTS; ++i) {
-        record_t dummy_record;
-        en_derive_interval_identifier((ENIntervalIdentifier*)&dummy_record.rolling_proximity_identifier, &pik, i);
-        dummy_record.timestamp = i; // very clever! ;)
-        bloom_add_record(bf, &dummy_record.rolling_proximity_identifier);
-        if (!bloom_probably_has_record(bf, &dummy_record.rolling_proximity_identifier)) {
-            printk("error!  bloom_probably_has_record\n");
-        }
+        record_t dummy_record = {0};
+        dummy_record.timestamp = i * seconds_per_record;
+        en_derive_interval_identifier(&dummy_record.rolling_proximity_identifier, &pik,
+                                      en_get_interval_number(dummy_record.timestamp));
+        add_record(&dummy_record);
     }
     printk("Done...\n");
     k_msleep(2000);
 
-    printk("Creating bloom filter...\n");
-    fill_bloom_with_stored_records(bf);
-    printk("Done...\n");
-    k_msleep(3000);
-
     do {
         printk("Checking keys...\n");
-        for(int k = 0; k < 144; k++) {
-
-            ENIntervalIdentifier rpi;
-            en_derive_period_identifier_key(&pik, &tek.tek);
-            // derive all RPIs
-            for (int j = 0; j < 144; j++) {
-
-                // we assume that at least one out of 144 RPIs was met (this is still a lot actually!)
-                uint32_t interval = j == 0 ? (CONFIG_ENS_MAX_CONTACTS / 144)*k : (CONFIG_ENS_MAX_CONTACTS+1);
-                en_derive_interval_identifier(&rpi, &pik, interval); //one of each is actually
-
-                uint32_t num_met = 0;
-                if (bloom_probably_has_record(bf, &rpi)) {
-                    num_met++;
-                    /*
-                    record_iterator_t iterator;
-
-                    time_t start = interval == 0 ? 0 : (interval+(CONFIG_ENS_MAX_CONTACTS-1)) % CONFIG_ENS_MAX_CONTACTS;
-                    time_t end = (interval+(CONFIG_ENS_MAX_CONTACTS+1)) % CONFIG_ENS_MAX_CONTACTS;
-
-                    int rc = ens_records_iterator_init_timerange(&iterator, &start, &end);
-                    if (rc) {
-                        // on error, skip this rpi
-                        printk("iterator error! %d\n", rc);
-                        continue;
-                    }
-                    record_t* current;
-                    while ((current = ens_records_iterator_next(&iterator))) {
-                        if (memcmp(&(current->rolling_proximity_identifier), rpi.b,
-                                   sizeof(current->rolling_proximity_identifier)) == 0) {
-                            num_met++;
-                        }
-                    }
-                    ens_record_iterator_clear(&iterator);*/
+        uint32_t missed = 0;
+        uint32_t false_positives = 0;
+        for (int day = 0; day < CONFIG_ENS_BLOOM_DAYS; day++) {
+            ENIntervalNumber rolling_start = day * EN_TEK_ROLLING_PERIOD;
+            static ENIntervalIdentifier rpis[EN_TEK_ROLLING_PERIOD];
+            // all RPIs of this day were met
+            en_batch_derive_interval_identifiers(rpis, &pik, rolling_start, EN_TEK_ROLLING_PERIOD);
+            for (int j = 0; j < EN_TEK_ROLLING_PERIOD; j++) {
+                if (!record_bloom_probably_has(&rpis[j], rolling_start)) {
+                    missed++;
                 }
-                if(j == 0 && num_met == 0) {
-                    printk("Met mismatch! %u\n", num_met);
+            }
+            // but none of a period never seen
+            en_batch_derive_interval_identifiers(rpis, &pik, CONFIG_ENS_BLOOM_DAYS * EN_TEK_ROLLING_PERIOD,
+                                                 EN_TEK_ROLLING_PERIOD);
+            for (int j = 0; j < EN_TEK_ROLLING_PERIOD; j++) {
+                if (record_bloom_probably_has(&rpis[j], rolling_start)) {
+                    false_positives++;
                 }
             }
-
         }
+        printk("Missed %u, false positives %u out of %u\n", missed, false_positives,
+               CONFIG_ENS_BLOOM_DAYS * EN_TEK_ROLLING_PERIOD);
         k_sleep(K_MSEC(2000));
     } while (1);
 }
 #endif
 
+#if CONFIG_CONTACTS_PERFORM_RISC_CHECK_TEST
+#define RISC_CHECK_TEST_KEY_COUNT MAX(1, CONFIG_CONTACTS_RISC_CHECK_TEST_PUBLIC_INTERVAL_COUNT / EN_TEK_ROLLING_PERIOD)
+
+static exposure_key_t test_keys[RISC_CHECK_TEST_KEY_COUNT];
+
+static void on_test_match(const exposure_key_t* key,
+                          ENIntervalNumber interval,
+                          const record_t* record,
+                          void* userdata) {
+    // we only count matches
+}
+
+/**
+ * Fill the record storage with test data and compare the time of all exposure check modes for growing batches of
+ * keys. The first keys (one per day) were met in CONFIG_TEST_INFECTED_RATE percent of the intervals.
+ */
+void exposure_check_test() {
+    printk("Filling record storage with test data...\n");
+    reset_record_storage();
+
+    uint32_t days = MAX(1, CONFIG_ENS_MAX_CONTACTS / (EN_TEK_ROLLING_PERIOD * CONFIG_TEST_RECORDS_PER_INTERVAL));
+    for (int i = 0; i < RISC_CHECK_TEST_KEY_COUNT; i++) {
+        en_generate_period_key(&test_keys[i].key);
+        test_keys[i].rolling_start_interval_number = (i % days) * EN_TEK_ROLLING_PERIOD;
+        test_keys[i].rolling_period = EN_TEK_ROLLING_PERIOD;
+    }
+
+    uint32_t infected_intervals = 0;
+    for (uint32_t day = 0; day < days; day++) {
+        ENPeriodIdentifierKey pik;
+        en_derive_period_identifier_key(&pik, &test_keys[day % RISC_CHECK_TEST_KEY_COUNT].key);
+        for (ENIntervalNumber interval = day * EN_TEK_ROLLING_PERIOD; interval < (day + 1) * EN_TEK_ROLLING_PERIOD;
+             interval++) {
+            bool infected = day < RISC_CHECK_TEST_KEY_COUNT && sys_rand32_get() % 100 < CONFIG_TEST_INFECTED_RATE;
+            infected_intervals += infected;
+            for (int i = 0; i < CONFIG_TEST_RECORDS_PER_INTERVAL; i++) {
+                record_t record = {0};
+                record.timestamp =
+                    interval * EN_INTERVAL_LENGTH + i * EN_INTERVAL_LENGTH / CONFIG_TEST_RECORDS_PER_INTERVAL;
+                if (infected && i == 0) {
+                    en_derive_interval_identifier(&record.rolling_proximity_identifier, &pik, interval);
+                } else {
+                    sys_rand_get(&record.rolling_proximity_identifier, sizeof(record.rolling_proximity_identifier));
+                }
+                add_record(&record);
+            }
+        }
+    }
+    printk("Stored %u records over %u days, %u infected intervals\n", get_num_records(), days, infected_intervals);
+
+    for (int count = 1;; count = MIN(count * 2, RISC_CHECK_TEST_KEY_COUNT)) {
+        uint32_t start = k_uptime_get_32();
+        int forward_matches = exposure_check_forward(test_keys, count, on_test_match, NULL);
+        uint32_t forward_ms = k_uptime_get_32() - start;
+
+        start = k_uptime_get_32();
+        int reverse_matches = exposure_check_reverse(test_keys, count, on_test_match, NULL);
+        uint32_t reverse_ms = k_uptime_get_32() - start;
+
+        start = k_uptime_get_32();
+        int join_matches = exposure_check_hash_join(test_keys, count, on_test_match, NULL);
+        uint32_t join_ms = k_uptime_get_32() - start;
+
+        printk("%d keys: forward %u ms (%d matches), reverse %u ms (%d matches), hash join %u ms (%d matches)\n", count,
+               forward_ms, forward_matches, reverse_ms, reverse_matches, join_ms, join_matches);
+        if (count == RISC_CHECK_TEST_KEY_COUNT) {
+            break;
+        }
+    }
+}
+#endif
+
+#if BLOOM_BENCHMARK
+/**
+ * Fill a bloom filter with random identifiers and measure the throughput and false positive rate of lookups with
+ * other random identifiers.
+ */
+void bloom_benchmark_run(bloom_filter_t* bf, const char* name) {
+    ENIntervalIdentifier rpi;
+    for (int i = 0; i < BLOOM_BENCHMARK_ENTRIES; i++) {
+        sys_rand_get(&rpi, sizeof(rpi));
+        bloom_add_record(bf, &rpi);
+    }
+
+    // the lookups itself are rather fast, so generate the identifiers upfront
+    static ENIntervalIdentifier probes[256];
+    uint32_t false_positives = 0;
+    uint64_t cycles = 0;
+    for (int i = 0; i < BLOOM_BENCHMARK_PROBES; i += ARRAY_SIZE(probes)) {
+        sys_rand_get(probes, sizeof(probes));
+        uint32_t start = k_cycle_get_32();
+        for (int j = 0; j < ARRAY_SIZE(probes); j++) {
+            false_positives += bloom_probably_has_record(bf, &probes[j]);
+        }
+        cycles += k_cycle_get_32() - start;
+    }
+
+    uint32_t ns = (uint32_t)k_cyc_to_ns_floor64(cycles);
+    printk("%s: %u bytes, %u hashes, %u probes in %u us (%u ns/probe), fpr %u ppm (estimated %u ppm)\n", name,
+           (uint32_t)bf->size, bf->num_hashes, BLOOM_BENCHMARK_PROBES, ns / 1000, ns / BLOOM_BENCHMARK_PROBES,
+           (uint32_t)((uint64_t)false_positives * 1000000 / BLOOM_BENCHMARK_PROBES),
+           (uint32_t)(bloom_estimate_fpr(bf) * 1000000));
+}
+
+/**
+ * Compare the standard and the blocked bloom filter.
+ */
+void bloom_benchmark() {
+    printk("Bloom benchmark with %u entries...\n", BLOOM_BENCHMARK_ENTRIES);
+
+    // only allocate one filter at a time
+    bloom_filter_t* bf = bloom_init(BLOOM_BENCHMARK_ENTRIES, BLOOM_FALSE_POSITIVE_RATE);
+    if (!bf) {
+        printk("init bloom filter failed\n");
+        return;
+    }
+    bloom_benchmark_run(bf, "standard");
+    bloom_destroy(bf);
+
+    bf = bloom_init_blocked(BLOOM_BENCHMARK_ENTRIES, BLOOM_FALSE_POSITIVE_RATE);
+    if (!bf) {
+        printk("init blocked bloom filter failed\n");
+        return;
+    }
+    bloom_benchmark_run(bf, "blocked");
+    bloom_destroy(bf);
+}
+#endif
+
+#if CONFIG_TEST_UNPACK_KEYS
+#define UNPACK_TEST_KEYS CONFIG_TEST_UNPACK_KEYS_N
+#define UNPACK_TEST_CHUNK_SIZE 244  // payload of a BLE packet with the maximum data length
+#define UNPACK_TEST_EXPORT_SIZE 64   // fields of the export besides its keys
+#define UNPACK_TEST_FILE_SIZE (KEY_EXPORT_HEADER_SIZE + UNPACK_TEST_EXPORT_SIZE + \
+                               UNPACK_TEST_KEYS * (2 + KEY_EXPORT_MAX_KEY_SIZE))
+
+// static, so the heap is left to protobuf-c
+static uint8_t unpack_test_file[UNPACK_TEST_FILE_SIZE];
+
+typedef int (*unpack_key_fn_t)(const uint8_t* message, size_t size, exposure_key_t* key);
+
+// heap usage of protobuf-c, each allocation is prefixed with its size
+static size_t unpack_heap_used;
+static size_t unpack_heap_peak;
+
+static void* counting_alloc(void* allocator_data, size_t size) {
+    uint64_t* block = k_malloc(sizeof(uint64_t) + size);
+    if (!block) {
+        return NULL;
+    }
+    block[0] = size;
+    unpack_heap_used += size;
+    unpack_heap_peak = MAX(unpack_heap_peak, unpack_heap_used);
+    return &block[1];
+}
+
+static void counting_free(void* allocator_data, void* pointer) {
+    if (!pointer) {
+        return;
+    }
+    uint64_t* block = (uint64_t*)pointer - 1;
+    unpack_heap_used -= block[0];
+    k_free(block);
+}
+
+static ProtobufCAllocator counting_allocator = {
+    .alloc = counting_alloc,
+    .free = counting_free,
+};
+
+static void print_unpack_result(const char* name, uint32_t keys, timing_t* start, timing_t* end, size_t heap) {
+    uint64_t cycles = timing_cycles_get(start, end);
+    uint64_t ns = MAX(timing_cycles_to_ns(cycles), 1);
+    printk("%s: %u keys in %u us, %u keys/s, %u cycles/key, peak heap %u bytes\n", name, keys, (uint32_t)(ns / 1000),
+           (uint32_t)((uint64_t)keys * 1000000000 / ns), (uint32_t)(cycles / MAX(keys, 1)), (uint32_t)heap);
+}
+
+static int count_key(const exposure_key_t* key, void* userdata) {
+    (*(uint32_t*)userdata)++;
+    return 0;
+}
+
+static void unpack_keys_decoder_run(const uint8_t* file, size_t size, size_t chunk, const char* name) {
+    key_export_decoder_t decoder;
+    uint32_t keys = 0;
+    timing_t start = timing_counter_get();
+    key_export_decoder_init(&decoder, count_key, &keys);
+    for (size_t pos = 0; pos < size; pos += chunk) {
+        key_export_decoder_feed(&decoder, &file[pos], MIN(chunk, size - pos));
+    }
+    int rc = key_export_decoder_finish(&decoder);
+    timing_t end = timing_counter_get();
+    if (rc || decoder.invalid_keys) {
+        printk("%s: decoding failed (err %d, %u invalid keys)\n", name, rc, decoder.invalid_keys);
+    }
+    // the decoder does not allocate
+    print_unpack_result(name, keys, &start, &end, 0);
+}
+
+static void unpack_keys_protobuf_run(const uint8_t* file, size_t size) {
+    unpack_heap_used = 0;
+    unpack_heap_peak = 0;
+    uint32_t keys = 0;
+    timing_t start = timing_counter_get();
+    TemporaryExposureKeyExport* export = temporary_exposure_key_export__unpack(
+        &counting_allocator, size - KEY_EXPORT_HEADER_SIZE, &file[KEY_EXPORT_HEADER_SIZE]);
+    if (export) {
+        // convert the keys like the decoder does
+        for (size_t i = 0; i < export->n_keys; i++) {
+            exposure_key_t key;
+            if (export->keys[i]->has_key_data && export->keys[i]->key_data.len == sizeof(key.key.b)) {
+                memcpy(key.key.b, export->keys[i]->key_data.data, sizeof(key.key.b));
+                key.rolling_start_interval_number = export->keys[i]->rolling_start_interval_number;
+                key.rolling_period = export->keys[i]->has_rolling_period ? export->keys[i]->rolling_period : 0;
+                count_key(&key, &keys);
+            }
+        }
+        temporary_exposure_key_export__free_unpacked(export, &counting_allocator);
+    }
+    timing_t end = timing_counter_get();
+    if (!export) {
+        printk("protobuf-c: unpacking failed, out of heap after %u bytes\n", (uint32_t)unpack_heap_peak);
+        return;
+    }
+    print_unpack_result("protobuf-c", keys, &start, &end, unpack_heap_peak);
+}
+
+/**
+ * Unpack each key message of the file on its own.
+ */
+static void unpack_keys_run(const uint8_t* keys, const uint8_t* end, unpack_key_fn_t unpack, const char* name) {
+    exposure_key_t key;
+    uint32_t count = 0;
+    timing_t start = timing_counter_get();
+    while (keys < end) {
+        // skip the tag of the keys field, the length of the messages is below 128 and takes a single byte
+        uint8_t size = keys[1];
+        count += unpack(&keys[2], size, &key) == 0;
+        keys += 2 + size;
+    }
+    timing_t stop = timing_counter_get();
+    print_unpack_result(name, count, &start, &stop, 0);
+}
+
+/**
+ * Serialize CONFIG_TEST_UNPACK_KEYS_N keys into an export file and measure packing it with protobuf-c and
+ * unpacking it with the streaming decoder and with protobuf-c. Key by key, the specialized parser is compared to
+ * protobuf-c as well.
+ */
+void unpack_keys_benchmark() {
+    printk("Unpack benchmark with %u keys...\n", UNPACK_TEST_KEYS);
+
+    TemporaryExposureKeyExport export = TEMPORARY_EXPOSURE_KEY_EXPORT__INIT;
+    export.has_start_timestamp = 1;
+    export.start_timestamp = 1608000000;
+    export.has_end_timestamp = 1;
+    export.end_timestamp = export.start_timestamp + EN_TEK_ROLLING_PERIOD * EN_INTERVAL_LENGTH;
+    export.region = "DE";
+    export.has_batch_num = 1;
+    export.batch_num = 1;
+    export.has_batch_size = 1;
+    export.batch_size = 1;
+
+    uint8_t* file = unpack_test_file;
+    if (temporary_exposure_key_export__get_packed_size(&export) > UNPACK_TEST_EXPORT_SIZE) {
+        printk("Export does not fit into the file\n");
+        return;
+    }
+    // the keys are variations of a random key, made on the fly, so only the file is kept in RAM
+    ENPeriodKey tek;
+    en_generate_period_key(&tek);
+
+    timing_init();
+    timing_start();
+
+    // protobuf-c packs repeated messages one after another behind the other fields, so the keys are appended one by
+    // one instead of holding all unpacked keys in RAM at once
+    timing_t start = timing_counter_get();
+    memcpy(file, KEY_EXPORT_HEADER, KEY_EXPORT_HEADER_SIZE);
+    uint8_t* pos = &file[KEY_EXPORT_HEADER_SIZE];
+    pos += temporary_exposure_key_export__pack(&export, pos);
+    uint8_t* keys = pos;
+    for (int i = 0; i < UNPACK_TEST_KEYS; i++) {
+        tek.b[0] = i;
+        tek.b[1] = i >> 8;
+        TemporaryExposureKey message = TEMPORARY_EXPOSURE_KEY__INIT;
+        message.has_key_data = 1;
+        message.key_data.data = tek.b;
+        message.key_data.len = sizeof(tek.b);
+        message.has_rolling_start_interval_number = 1;
+        message.rolling_start_interval_number = 2642976 + (i % 14) * EN_TEK_ROLLING_PERIOD;
+        message.has_rolling_period = 1;
+        message.rolling_period = EN_TEK_ROLLING_PERIOD;
+        message.has_report_type = 1;
+        message.report_type = TEMPORARY_EXPOSURE_KEY__REPORT_TYPE__CONFIRMED_TEST;
+        message.has_days_since_onset_of_symptoms = 1;
+        message.days_since_onset_of_symptoms = (i % 14) - 7;
+        *pos++ = 0x3a;  // keys field, length delimited
+        *pos++ = temporary_exposure_key__get_packed_size(&message);
+        pos += temporary_exposure_key__pack(&message, pos);
+    }
+    timing_t end = timing_counter_get();
+    size_t size = pos - file;
+    printk("Export file of %u bytes\n", (uint32_t)size);
+    print_unpack_result("pack", UNPACK_TEST_KEYS, &start, &end, 0);
+
+    unpack_keys_decoder_run(file, size, size, "decoder");
+    unpack_keys_decoder_run(file, size, UNPACK_TEST_CHUNK_SIZE, "decoder, chunked");
+    unpack_keys_protobuf_run(file, size);
+    unpack_keys_run(keys, pos, key_export_unpack_key, "specialized, per key");
+    unpack_keys_run(keys, pos, key_export_unpack_key_protobuf, "protobuf-c, per key");
+
+    timing_stop();
+}
+#endif
+
 void main(void) {
 
     int err = 0;
@@ -155,6 +444,19 @@ void main(void) {
         return;
     }
 
+    #if CONFIG_TEST_UNPACK_KEYS
+    unpack_keys_benchmark();
+    #endif
+
+    #if BLOOM_BENCHMARK
+    bloom_benchmark();
+    #endif
+
+    #if CONFIG_CONTACTS_PERFORM_RISC_CHECK_TEST
+    exposure_check_test();
+    return;
+    #endif
+
     #if BLOOM_TEST
     k_msleep(10000);
     bloom_test();
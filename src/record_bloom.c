@@ -0,0 +1,589 @@
+/*
+ * Copyright (c) 2020 Olaf Landsiedel
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <drivers/flash.h>
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <storage/flash_map.h>
+#include <sys/crc.h>
+#include <zephyr.h>
+
+#include "bloom.h"
+#include "fuse_filter.h"
+#include "record_bloom.h"
+
+#define RECORD_BLOOM_FALSE_POSITIVE_RATE 0.01f
+#define SECONDS_PER_DAY (EN_INTERVAL_LENGTH * EN_TEK_ROLLING_PERIOD)
+#define INTERVAL_BITMAP_SIZE ((EN_TEK_ROLLING_PERIOD + 7) / 8)
+
+// upper bound of the heap of a blocked bloom filter partition at RECORD_BLOOM_FALSE_POSITIVE_RATE (about 10.5 bits per
+// entry), including its struct
+#define PARTITION_HEAP_SIZE (CONFIG_ENS_BLOOM_PARTITION_ENTRIES * 4 / 3 + 64)
+
+// the partitions are held permanently, see the heap budget of CONFIG_ENS_BLOOM_PARTITION_ENTRIES
+BUILD_ASSERT((uint64_t)CONFIG_ENS_BLOOM_DAYS * PARTITION_HEAP_SIZE <= CONFIG_HEAP_MEM_POOL_SIZE / 4,
+             "The bloom filter partitions take more than a quarter of the heap");
+
+#define SNAPSHOT_MAGIC 0x424c4d53  // "BLMS"
+#define SNAPSHOT_VERSION 4
+
+/**
+ * Header of a snapshot at the start of the bloom_storage partition, followed by partition_count partitions (each a
+ * snapshot_partition_t followed by its filter data). The header is written last, so an incomplete snapshot is never
+ * valid.
+ */
+typedef struct snapshot_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t partition_count;
+    record_sequence_number_t watermark;  // sn of the first record not contained in the snapshot
+    uint32_t incomplete_until;
+    uint8_t has_incomplete;
+    uint8_t rsv[3];
+    uint32_t crc;  // crc32 of all partitions and this header (up to this field)
+} __packed snapshot_header_t;
+
+enum partition_type {
+    PARTITION_TYPE_BLOOM,
+    PARTITION_TYPE_FUSE,
+};
+
+typedef struct snapshot_partition {
+    uint32_t day;
+    uint8_t type;  // see enum partition_type
+    uint8_t incomplete;
+    uint8_t rsv[2];
+    uint32_t count;
+    uint32_t num_bits;  // only bloom filters
+    uint32_t size;
+    uint64_t seed;  // only fuse filters
+    uint8_t intervals[INTERVAL_BITMAP_SIZE];
+    uint8_t rsv2[(4 - INTERVAL_BITMAP_SIZE % 4) % 4];
+} __packed snapshot_partition_t;
+
+/**
+ * A partition uses a bloom filter while records of its day might still be added. Once its day is over, it is compacted
+ * to an immutable fuse filter, which needs less memory.
+ */
+typedef struct bloom_partition {
+    uint32_t day;
+    bloom_filter_t* bloom;
+    fuse_filter_t* fuse;
+    bool incomplete;  // a record was stored after compacting this partition
+    uint8_t intervals[INTERVAL_BITMAP_SIZE];  // bit i is set, if we stored a record during interval i of the day
+} bloom_partition_t;
+
+static bloom_partition_t partitions[CONFIG_ENS_BLOOM_DAYS];
+
+// Days up to this one lost their partition while they still had records (or its allocation failed)
+static uint32_t incomplete_until = 0;
+static bool has_incomplete = false;
+
+static struct k_mutex bloom_lock;
+
+static const struct flash_area* snapshot_area;
+
+// sn of the record after the last one added
+static record_sequence_number_t watermark;
+static bool has_watermark = false;
+
+static inline bool is_used(bloom_partition_t* partition) {
+    return partition->bloom || partition->fuse;
+}
+
+static bloom_partition_t* find_partition(uint32_t day) {
+    for (int i = 0; i < CONFIG_ENS_BLOOM_DAYS; i++) {
+        if (is_used(&partitions[i]) && partitions[i].day == day) {
+            return &partitions[i];
+        }
+    }
+    return NULL;
+}
+
+static void drop_partition(bloom_partition_t* partition) {
+    if (partition->bloom) {
+        bloom_destroy(partition->bloom);
+        partition->bloom = NULL;
+    }
+    if (partition->fuse) {
+        fuse_filter_destroy(partition->fuse);
+        partition->fuse = NULL;
+    }
+    partition->incomplete = false;
+}
+
+/**
+ * Mark all days up to the given one as incomplete, lookups for them always succeed.
+ */
+static void mark_incomplete(uint32_t day) {
+    if (!has_incomplete || day > incomplete_until) {
+        incomplete_until = day;
+    }
+    has_incomplete = true;
+}
+
+/**
+ * Get a new partition for the day. If all are in use, the partition of the oldest day is dropped.
+ */
+static bloom_partition_t* create_partition(uint32_t day) {
+    bloom_partition_t* partition = NULL;
+    for (int i = 0; i < CONFIG_ENS_BLOOM_DAYS; i++) {
+        if (!is_used(&partitions[i])) {
+            partition = &partitions[i];
+            break;
+        }
+        if (!partition || partitions[i].day < partition->day) {
+            partition = &partitions[i];
+        }
+    }
+
+    if (is_used(partition)) {
+        if (partition->day > day) {
+            // all partitions are for newer days
+            mark_incomplete(day);
+            return NULL;
+        }
+        mark_incomplete(partition->day);
+        drop_partition(partition);
+    }
+
+    partition->day = day;
+    memset(partition->intervals, 0, sizeof(partition->intervals));
+    partition->bloom = bloom_init_blocked(CONFIG_ENS_BLOOM_PARTITION_ENTRIES, RECORD_BLOOM_FALSE_POSITIVE_RATE);
+    if (!partition->bloom) {
+        printk("Cannot allocate bloom filter partition\n");
+        mark_incomplete(day);
+        return NULL;
+    }
+    return partition;
+}
+
+static void clear_partitions() {
+    for (int i = 0; i < CONFIG_ENS_BLOOM_DAYS; i++) {
+        drop_partition(&partitions[i]);
+    }
+    has_incomplete = false;
+    has_watermark = false;
+}
+
+/**
+ * Erase the header of our snapshot, so it is not loaded anymore.
+ */
+static void invalidate_snapshot() {
+    if (!snapshot_area) {
+        return;
+    }
+    struct flash_pages_info info;
+    if (flash_get_page_info_by_offs(flash_area_get_device(snapshot_area), snapshot_area->fa_off, &info) == 0) {
+        flash_area_erase(snapshot_area, 0, info.size);
+    }
+}
+
+/**
+ * Load the partitions of our snapshot, if it is valid and its watermark is within our stored records.
+ *
+ * @param watermark_dest the sn of the first record, which is not contained in the snapshot
+ *
+ * @return 0 on success
+ */
+static int load_snapshot(record_sequence_number_t* watermark_dest) {
+    snapshot_header_t header;
+    if (!snapshot_area || flash_area_read(snapshot_area, 0, &header, sizeof(header))) {
+        return -1;
+    }
+    if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION ||
+        header.partition_count > CONFIG_ENS_BLOOM_DAYS) {
+        return -1;
+    }
+
+    // the snapshot has to end within our stored records, otherwise they changed in the meantime
+    record_sequence_number_t oldest;
+    record_sequence_number_t latest;
+    if (get_sequence_number_interval(&oldest, &latest) ||
+        sn_distance(oldest, header.watermark) > sn_distance(oldest, latest) + 1) {
+        return -1;
+    }
+
+    off_t offset = sizeof(header);
+    uint32_t crc = 0;
+    for (int i = 0; i < header.partition_count; i++) {
+        snapshot_partition_t stored;
+        if (flash_area_read(snapshot_area, offset, &stored, sizeof(stored))) {
+            goto fail;
+        }
+        crc = crc32_ieee_update(crc, (uint8_t*)&stored, sizeof(stored));
+        offset += sizeof(stored);
+
+        partitions[i].day = stored.day;
+        partitions[i].incomplete = stored.incomplete;
+        memcpy(partitions[i].intervals, stored.intervals, sizeof(partitions[i].intervals));
+        uint8_t* data;
+        if (stored.type == PARTITION_TYPE_FUSE) {
+            fuse_filter_t* fuse = fuse_filter_init(stored.count);
+            partitions[i].fuse = fuse;
+            if (!fuse || fuse->array_length != stored.size) {
+                goto fail;
+            }
+            fuse->seed = stored.seed;
+            data = fuse->fingerprints;
+        } else {
+            bloom_filter_t* bloom =
+                bloom_init_blocked(CONFIG_ENS_BLOOM_PARTITION_ENTRIES, RECORD_BLOOM_FALSE_POSITIVE_RATE);
+            partitions[i].bloom = bloom;
+            // the partitions need to match our configuration
+            if (!bloom || bloom->size != stored.size || bloom->num_bits != stored.num_bits) {
+                goto fail;
+            }
+            bloom->count = stored.count;
+            data = bloom->data;
+        }
+        if (flash_area_read(snapshot_area, offset, data, stored.size)) {
+            goto fail;
+        }
+        crc = crc32_ieee_update(crc, data, stored.size);
+        offset += ROUND_UP(stored.size, 4);
+    }
+
+    crc = crc32_ieee_update(crc, (uint8_t*)&header, offsetof(snapshot_header_t, crc));
+    if (crc != header.crc) {
+        goto fail;
+    }
+
+    has_incomplete = header.has_incomplete;
+    incomplete_until = header.incomplete_until;
+    *watermark_dest = header.watermark;
+    return 0;
+
+fail:
+    clear_partitions();
+    return -1;
+}
+
+int record_bloom_init() {
+    k_mutex_init(&bloom_lock);
+    clear_partitions();
+
+    int rc = flash_area_open(FLASH_AREA_ID(bloom_storage), &snapshot_area);
+    if (rc) {
+        printk("Cannot open bloom filter snapshot (err %d)\n", rc);
+        snapshot_area = NULL;
+    }
+
+    // without a snapshot we need to add all stored records
+    record_sequence_number_t start;
+    bool loaded = load_snapshot(&start) == 0;
+    if (!loaded) {
+        invalidate_snapshot();
+    }
+
+    record_iterator_t iterator;
+    rc = ens_records_iterator_init_range(&iterator, loaded ? &start : NULL, NULL);
+    if (rc) {
+        return rc;
+    }
+
+    int added = 0;
+    record_t* current;
+    while ((current = ens_records_iterator_next(&iterator))) {
+        record_bloom_add(current);
+        added++;
+    }
+    ens_record_iterator_clear(&iterator);
+
+    printk("Bloom filter: %s snapshot, added %d records\n", loaded ? "loaded" : "no", added);
+    return added;
+}
+
+int record_bloom_snapshot() {
+    if (!snapshot_area) {
+        return -1;
+    }
+
+    // erase first, we still have our partitions in RAM if anything fails
+    int rc = flash_area_erase(snapshot_area, 0, snapshot_area->fa_size);
+    if (rc) {
+        return rc;
+    }
+
+    k_mutex_lock(&bloom_lock, K_FOREVER);
+    snapshot_header_t header = {
+        .magic = SNAPSHOT_MAGIC,
+        .version = SNAPSHOT_VERSION,
+        .partition_count = 0,
+        .watermark = watermark,
+        .incomplete_until = incomplete_until,
+        .has_incomplete = has_incomplete,
+    };
+    if (!has_watermark) {
+        // nothing to store
+        rc = -1;
+        goto end;
+    }
+
+    off_t offset = sizeof(header);
+    uint32_t crc = 0;
+    for (int i = 0; i < CONFIG_ENS_BLOOM_DAYS; i++) {
+        bloom_partition_t* partition = &partitions[i];
+        if (!is_used(partition)) {
+            continue;
+        }
+
+        snapshot_partition_t stored = {
+            .day = partition->day,
+            .incomplete = partition->incomplete,
+        };
+        memcpy(stored.intervals, partition->intervals, sizeof(stored.intervals));
+        uint8_t* data;
+        if (partition->fuse) {
+            stored.type = PARTITION_TYPE_FUSE;
+            stored.count = partition->fuse->count;
+            stored.size = partition->fuse->array_length;
+            stored.seed = partition->fuse->seed;
+            data = partition->fuse->fingerprints;
+        } else {
+            stored.type = PARTITION_TYPE_BLOOM;
+            stored.count = partition->bloom->count;
+            stored.num_bits = partition->bloom->num_bits;
+            stored.size = partition->bloom->size;
+            data = partition->bloom->data;
+        }
+        // keep our flash writes aligned
+        uint32_t padded_size = ROUND_UP(stored.size, 4);
+
+        if (offset + sizeof(stored) + padded_size > snapshot_area->fa_size) {
+            printk("Bloom filter snapshot does not fit into its partition\n");
+            rc = -ENOSPC;
+            goto end;
+        }
+
+        rc = flash_area_write(snapshot_area, offset, &stored, sizeof(stored));
+        if (rc) {
+            goto end;
+        }
+        crc = crc32_ieee_update(crc, (uint8_t*)&stored, sizeof(stored));
+        offset += sizeof(stored);
+
+        rc = flash_area_write(snapshot_area, offset, data, stored.size - stored.size % 4);
+        if (!rc && stored.size % 4) {
+            uint8_t tail[4] = {0};
+            memcpy(tail, &data[stored.size - stored.size % 4], stored.size % 4);
+            rc = flash_area_write(snapshot_area, offset + stored.size - stored.size % 4, tail, sizeof(tail));
+        }
+        if (rc) {
+            goto end;
+        }
+        crc = crc32_ieee_update(crc, data, stored.size);
+        offset += padded_size;
+        header.partition_count++;
+    }
+
+    header.crc = crc32_ieee_update(crc, (uint8_t*)&header, offsetof(snapshot_header_t, crc));
+    rc = flash_area_write(snapshot_area, 0, &header, sizeof(header));
+
+end:
+    k_mutex_unlock(&bloom_lock);
+    return rc;
+}
+
+/**
+ * Build a fuse filter of the stored records of the day.
+ *
+ * @param count the amount of records added to the day
+ */
+static fuse_filter_t* build_fuse_filter(uint32_t day, uint32_t count) {
+    if (count > FUSE_FILTER_MAX_KEYS) {
+        return NULL;
+    }
+    uint32_t* keys = k_malloc(MAX(count, 1) * sizeof(uint32_t));
+    // the iterator buffers records, too large for the stack of the work queue
+    record_iterator_t* iterator = k_malloc(sizeof(record_iterator_t));
+    fuse_filter_t* fuse = NULL;
+    if (!keys || !iterator) {
+        goto end;
+    }
+
+    time_t start = (time_t)day * SECONDS_PER_DAY;
+    time_t end = start + SECONDS_PER_DAY - 1;
+    if (ens_records_iterator_init_timerange(iterator, &start, &end)) {
+        goto end;
+    }
+    uint32_t found = 0;
+    record_t* current;
+    while ((current = ens_records_iterator_next(iterator))) {
+        if (current->timestamp / SECONDS_PER_DAY != day) {
+            continue;
+        }
+        if (found == count) {
+            // more records than added to the partition, the day has changed in the meantime
+            goto end;
+        }
+        keys[found++] = fuse_filter_key_from_rpi(&current->rolling_proximity_identifier);
+    }
+    fuse = fuse_filter_build(keys, found);
+
+end:
+    if (iterator) {
+        ens_record_iterator_clear(iterator);
+    }
+    k_free(iterator);
+    k_free(keys);
+    return fuse;
+}
+
+int record_bloom_compact() {
+    int compacted = 0;
+    while (true) {
+        // find a bloom filter of a day before yesterday, later records of these days are unlikely, which is larger
+        // than its fuse filter
+        k_mutex_lock(&bloom_lock, K_FOREVER);
+        uint32_t newest_day = 0;
+        for (int i = 0; i < CONFIG_ENS_BLOOM_DAYS; i++) {
+            if (is_used(&partitions[i])) {
+                newest_day = MAX(newest_day, partitions[i].day);
+            }
+        }
+        bloom_partition_t* partition = NULL;
+        for (int i = 0; i < CONFIG_ENS_BLOOM_DAYS; i++) {
+            if (partitions[i].bloom && partitions[i].day + 1 < newest_day &&
+                fuse_filter_size(partitions[i].bloom->count) < partitions[i].bloom->size) {
+                partition = &partitions[i];
+                break;
+            }
+        }
+        if (!partition) {
+            k_mutex_unlock(&bloom_lock);
+            break;
+        }
+        uint32_t day = partition->day;
+        uint32_t count = partition->bloom->count;
+        k_mutex_unlock(&bloom_lock);
+
+        // build without holding our lock, this reads all records of the day
+        fuse_filter_t* fuse = build_fuse_filter(day, count);
+        if (!fuse) {
+            printk("Cannot compact bloom filter of day %u\n", day);
+            break;
+        }
+
+        k_mutex_lock(&bloom_lock, K_FOREVER);
+        partition = find_partition(day);
+        if (partition && partition->bloom && partition->bloom->count == count &&
+            fuse->array_length < partition->bloom->size) {
+            bloom_destroy(partition->bloom);
+            partition->bloom = NULL;
+            partition->fuse = fuse;
+            fuse = NULL;
+            compacted++;
+        }
+        k_mutex_unlock(&bloom_lock);
+
+        if (fuse) {
+            // records were added in the meantime or duplicates changed the size, try again at the next compaction
+            fuse_filter_destroy(fuse);
+            break;
+        }
+    }
+    return compacted;
+}
+
+bool record_bloom_add(const record_t* record) {
+    uint32_t day = record->timestamp / SECONDS_PER_DAY;
+    bool created = false;
+
+    k_mutex_lock(&bloom_lock, K_FOREVER);
+    watermark = sn_increment(record->sn);
+    has_watermark = true;
+    if (has_incomplete && day <= incomplete_until) {
+        goto end;
+    }
+    bloom_partition_t* partition = find_partition(day);
+    if (!partition) {
+        partition = create_partition(day);
+        created = partition != NULL;
+    }
+    if (partition) {
+        uint32_t interval = record->timestamp % SECONDS_PER_DAY / EN_INTERVAL_LENGTH;
+        partition->intervals[interval / 8] |= 1 << (interval % 8);
+    }
+    if (partition && partition->fuse) {
+        // the day was already compacted, so we cannot rule out any identifier of it anymore
+        partition->incomplete = true;
+    } else if (partition) {
+        bloom_add_record(partition->bloom, (ENIntervalIdentifier*)&record->rolling_proximity_identifier);
+    }
+end:
+    k_mutex_unlock(&bloom_lock);
+    return created;
+}
+
+void record_bloom_expire(uint32_t oldest_timestamp) {
+    uint32_t oldest_day = oldest_timestamp / SECONDS_PER_DAY;
+
+    k_mutex_lock(&bloom_lock, K_FOREVER);
+    for (int i = 0; i < CONFIG_ENS_BLOOM_DAYS; i++) {
+        if (is_used(&partitions[i]) && partitions[i].day < oldest_day) {
+            drop_partition(&partitions[i]);
+        }
+    }
+    if (has_incomplete && incomplete_until < oldest_day) {
+        has_incomplete = false;
+    }
+    k_mutex_unlock(&bloom_lock);
+}
+
+void record_bloom_clear() {
+    k_mutex_lock(&bloom_lock, K_FOREVER);
+    clear_partitions();
+    invalidate_snapshot();
+    k_mutex_unlock(&bloom_lock);
+}
+
+void record_bloom_get_intervals(ENIntervalNumber first, uint32_t count, uint8_t* bitmap) {
+    memset(bitmap, 0, (count + 7) / 8);
+
+    k_mutex_lock(&bloom_lock, K_FOREVER);
+    bloom_partition_t* partition = NULL;
+    for (uint32_t i = 0; i < count; i++) {
+        ENIntervalNumber interval = first + i;
+        uint32_t day = interval / EN_TEK_ROLLING_PERIOD;
+        uint32_t offset = interval % EN_TEK_ROLLING_PERIOD;
+        if (i == 0 || offset == 0) {
+            partition = find_partition(day);
+        }
+
+        bool stored;
+        if (partition) {
+            stored = partition->incomplete || partition->intervals[offset / 8] & (1 << (offset % 8));
+        } else {
+            // we do not know about days without partition, whose records we had to drop
+            stored = has_incomplete && day <= incomplete_until;
+        }
+        if (stored) {
+            bitmap[i / 8] |= 1 << (i % 8);
+        }
+    }
+    k_mutex_unlock(&bloom_lock);
+}
+
+bool record_bloom_probably_has(ENIntervalIdentifier* rpi, ENIntervalNumber rolling_start_interval_number) {
+    uint32_t day = rolling_start_interval_number / EN_TEK_ROLLING_PERIOD;
+
+    k_mutex_lock(&bloom_lock, K_FOREVER);
+    bool result;
+    bloom_partition_t* partition = find_partition(day);
+    if (partition && partition->incomplete) {
+        result = true;
+    } else if (partition && partition->fuse) {
+        result = fuse_filter_contains(partition->fuse, fuse_filter_key_from_rpi(rpi));
+    } else if (partition) {
+        result = bloom_probably_has_record(partition->bloom, rpi);
+    } else {
+        // without a partition we did not store any record that day, unless we had to drop it
+        result = has_incomplete && day <= incomplete_until;
+    }
+    k_mutex_unlock(&bloom_lock);
+    return result;
+}
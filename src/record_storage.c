@@ -1,5 +1,6 @@
 #include <device.h>
 #include <drivers/flash.h>
+#include <errno.h>
 #include <fs/nvs.h>
 #include <logging/log.h>
 #include <power/reboot.h>
@@ -9,6 +10,7 @@
 #include <sys/types.h>
 
 #include "utility/ens_fs.h"
+#include "record_bloom.h"
 #include "record_storage.h"
 
 #define STORED_CONTACTS_INFO_ID 0
@@ -19,27 +21,108 @@ static struct k_mutex info_fs_lock;
 static ens_fs_t ens_fs;
 
 // Information about currently stored contacts
-static stored_records_information_t record_information = {.oldest_contact = 0, .count = 0};
+static stored_records_information_t record_information = {
+    .oldest_contact = 0,
+    .count = 0,
+    .layout_version = RECORD_LAYOUT_VERSION,
+};
+
+// Amount of records added since our storage information was last written to flash
+static uint32_t records_since_checkpoint = 0;
+
+// Timestamp of the first record of each sector, used to resolve time ranges without searching the flash
+static uint32_t* sector_timestamps;
+// Buffer for reading all records of a sector at once
+static uint8_t* sector_buffer;
+
+#define TIMESTAMP_UNKNOWN UINT32_MAX
+
+// Work queue for erasing sectors ahead of our write position and snapshotting the bloom filter
+K_THREAD_STACK_DEFINE(reclaim_stack, CONFIG_ENS_RECLAIM_STACK_SIZE);
+static struct k_work_q reclaim_work_q;
+static struct k_work reclaim_work;
+static struct k_work bloom_snapshot_work;
 
 inline storage_id_t convert_sn_to_storage_id(record_sequence_number_t sn) {
     return (storage_id_t)(sn % CONFIG_ENS_MAX_CONTACTS);
 }
 
+static inline uint32_t get_records_per_sector() {
+    return ens_fs.sector_size / ens_fs.interal_size;
+}
+
+static inline uint32_t get_sector_for_sn(record_sequence_number_t sn) {
+    return convert_sn_to_storage_id(sn) / get_records_per_sector();
+}
+
+/**
+ * @return the sequence number the next added record will get
+ */
+static record_sequence_number_t get_next_sequence_number() {
+    return get_latest_sequence_number() == get_oldest_sequence_number() ? 0
+                                                                         : sn_increment(get_latest_sequence_number());
+}
+
+/**
+ * Count the erased entries starting at the given id, stops counting as soon as limit is reached.
+ */
+static uint32_t count_erased_ahead(storage_id_t id, uint32_t limit) {
+    uint32_t erased = 0;
+    // all entries after an erased one are erased as well, so we can skip to the next sector
+    while (erased < limit && ens_fs_is_erased(&ens_fs, id)) {
+        uint32_t remaining = get_records_per_sector() - id % get_records_per_sector();
+        erased += remaining;
+        id = (id + remaining) % CONFIG_ENS_MAX_CONTACTS;
+    }
+    return erased;
+}
+
+/**
+ * Drop the bloom filter partitions of days, whose records are all gone. Needs to be called after the oldest record
+ * changed.
+ */
+static void expire_bloom_partitions() {
+    if (record_information.count == 0) {
+        record_bloom_clear();
+        return;
+    }
+
+    // the first timestamp of the sector is never newer than the one of our oldest record
+    uint32_t oldest_timestamp = sector_timestamps[get_sector_for_sn(record_information.oldest_contact)];
+    if (oldest_timestamp == TIMESTAMP_UNKNOWN) {
+        record_t rec;
+        if (load_record(&rec, record_information.oldest_contact)) {
+            return;
+        }
+        oldest_timestamp = rec.timestamp;
+    }
+    // later records might be older by up to RECORD_MAX_APPEND_DELAY
+    record_bloom_expire(oldest_timestamp > RECORD_MAX_APPEND_DELAY ? oldest_timestamp - RECORD_MAX_APPEND_DELAY : 0);
+}
+
 /**
- * Load our initial storage information from flash.
+ * Load our initial storage information from flash. Without information or with records of another layout, which we
+ * cannot read, the information is reset.
+ *
+ * @return 0 on success, 1 if the information was reset, negative on errors
  */
 int load_storage_information() {
     k_mutex_lock(&info_fs_lock, K_FOREVER);
     size_t size = sizeof(record_information);
     int rc = nvs_read(&info_fs, STORED_CONTACTS_INFO_ID, &record_information, size);
 
-    // Check, if read what we wanted
-    if (rc != size) {
-        // Write our initial data to storage
-        int rc = nvs_write(&info_fs, STORED_CONTACTS_INFO_ID, &record_information, size);
-        if (rc <= 0) {
-            return rc;
+    // Check, if read what we wanted (information without version has an older size)
+    if (rc != size || record_information.layout_version != RECORD_LAYOUT_VERSION) {
+        if (rc > 0) {
+            printk("Dropping stored records of an older layout\n");
         }
+        record_information.oldest_contact = 0;
+        record_information.count = 0;
+        record_information.layout_version = RECORD_LAYOUT_VERSION;
+        // Write our initial data to storage
+        rc = nvs_write(&info_fs, STORED_CONTACTS_INFO_ID, &record_information, size);
+        k_mutex_unlock(&info_fs_lock);
+        return rc < 0 ? rc : 1;
     }
     k_mutex_unlock(&info_fs_lock);
     return 0;
@@ -53,11 +136,128 @@ int save_storage_information() {
     int rc = nvs_write(&info_fs, STORED_CONTACTS_INFO_ID, &record_information, sizeof(record_information));
     if (rc <= 0) {
         printk("Something went wrong after saving storage information.\n");
+    } else {
+        records_since_checkpoint = 0;
     }
     k_mutex_unlock(&info_fs_lock);
     return rc;
 }
 
+/**
+ * Recover the records which were added after our last checkpoint of the storage information.
+ *
+ * Starting at the next sequence number, we load entries as long as they are valid and carry the expected sequence
+ * number. We never cross into a new sector, as add_record always checkpoints after starting a sector. This way stale
+ * entries of an earlier lap are never mistaken for new ones.
+ *
+ * @return the amount of recovered records
+ */
+static uint32_t recover_storage_information() {
+    uint32_t recovered = 0;
+    k_mutex_lock(&info_fs_lock, K_FOREVER);
+
+    while (recovered < CONFIG_ENS_MAX_CONTACTS) {
+        record_sequence_number_t next_sn = get_next_sequence_number();
+        if (convert_sn_to_storage_id(next_sn) % get_records_per_sector() == 0) {
+            break;
+        }
+
+        record_t rec;
+        if (load_record(&rec, next_sn) || !sn_equal(rec.sn, next_sn)) {
+            break;
+        }
+
+        // same accounting as in add_record
+        if (record_information.count >= CONFIG_ENS_MAX_CONTACTS) {
+            record_information.oldest_contact = sn_increment(record_information.oldest_contact);
+        } else {
+            record_information.count++;
+        }
+        recovered++;
+    }
+
+    if (recovered) {
+        save_storage_information();
+    }
+    k_mutex_unlock(&info_fs_lock);
+    return recovered;
+}
+
+/**
+ * Erase the next sector ahead of our write position, if less than CONFIG_ENS_RECLAIM_LOW_WATER erased entries are left.
+ * Records in that sector are removed from our information before erasing it.
+ */
+static void reclaim_work_handler(struct k_work* work) {
+    k_mutex_lock(&info_fs_lock, K_FOREVER);
+
+    uint32_t records_per_sector = get_records_per_sector();
+    storage_id_t next_id = convert_sn_to_storage_id(get_next_sequence_number());
+    uint32_t erased = count_erased_ahead(next_id, CONFIG_ENS_RECLAIM_LOW_WATER);
+    storage_id_t target_id = (next_id + erased) % CONFIG_ENS_MAX_CONTACTS;
+
+    if (erased >= CONFIG_ENS_RECLAIM_LOW_WATER || target_id % records_per_sector) {
+        // enough space left or our write position is in the middle of a sector, which is handled by add_record
+        k_mutex_unlock(&info_fs_lock);
+        return;
+    }
+
+    // our oldest records are in this sector, if we would run out of space before reaching it
+    int64_t lost = (int64_t)record_information.count + erased + records_per_sector - CONFIG_ENS_MAX_CONTACTS;
+    lost = MAX(0, MIN(lost, records_per_sector));
+    // the sector will get a new first timestamp
+    sector_timestamps[target_id / records_per_sector] = TIMESTAMP_UNKNOWN;
+    if (lost) {
+        record_information.count -= lost;
+        record_information.oldest_contact = sn_increment_by(record_information.oldest_contact, lost);
+        ens_fs_flush(&ens_fs);
+        save_storage_information();
+        expire_bloom_partitions();
+    }
+    k_mutex_unlock(&info_fs_lock);
+
+    // erase without holding our lock, so records can be added in the meantime
+    int rc = ens_fs_pre_erase(&ens_fs, target_id);
+    if (rc < 0) {
+        printk("Pre-erasing sector failed (err %d)\n", rc);
+    }
+}
+
+static void bloom_snapshot_work_handler(struct k_work* work) {
+    record_bloom_compact();
+    int rc = record_bloom_snapshot();
+    if (rc) {
+        printk("Bloom filter snapshot failed (err %d)\n", rc);
+    }
+}
+
+/**
+ * Initialize the timestamp of each sector with its first stored record.
+ */
+static void init_sector_timestamps() {
+    for (uint32_t i = 0; i < CONFIG_ENS_MAX_CONTACTS / get_records_per_sector(); i++) {
+        sector_timestamps[i] = TIMESTAMP_UNKNOWN;
+    }
+
+    record_sequence_number_t sn;
+    record_sequence_number_t latest;
+    if (get_sequence_number_interval(&sn, &latest)) {
+        return;
+    }
+
+    while (true) {
+        record_t rec;
+        if (load_record(&rec, sn) == 0) {
+            sector_timestamps[get_sector_for_sn(sn)] = rec.timestamp;
+        }
+        // continue at the start of the next sector
+        uint32_t to_next = get_records_per_sector() - sn % get_records_per_sector();
+        if (to_next > sn_distance(sn, latest)) {
+            break;
+        }
+        sn = sn_increment_by(sn, to_next);
+    }
+}
+
 int record_storage_init(bool clean) {
     int rc = 0;
     struct flash_pages_info info;
@@ -95,16 +295,52 @@ int record_storage_init(bool clean) {
             printk("Cannot load storage information (err %d)\n", rc);
             return rc;
         }
+        // the stored records are unusable without information, so we start like a clean init
+        clean = rc > 0;
     }
 
-    printk("Currently %d contacts stored!\n", record_information.count);
-    printk("Space available: %d\n", FLASH_AREA_SIZE(storage));
-
     rc = ens_fs_init(&ens_fs, FLASH_AREA_ID(ens_storage), sizeof(record_t));
     if (rc) {
         printk("Cannot init ens_fs (err %d)\n", rc);
+        return rc;
     }
-    return rc;
+
+    sector_timestamps = k_malloc(CONFIG_ENS_MAX_CONTACTS / get_records_per_sector() * sizeof(*sector_timestamps));
+    sector_buffer = k_malloc(get_records_per_sector() * ens_fs.interal_size);
+    if (sector_timestamps == NULL || sector_buffer == NULL) {
+        printk("Cannot allocate timestamp index\n");
+        return -ENOMEM;
+    }
+
+    k_work_q_start(&reclaim_work_q, reclaim_stack, K_THREAD_STACK_SIZEOF(reclaim_stack),
+                   K_LOWEST_APPLICATION_THREAD_PRIO);
+    k_work_init(&reclaim_work, reclaim_work_handler);
+    k_work_init(&bloom_snapshot_work, bloom_snapshot_work_handler);
+
+    if (clean) {
+        // erase the first sector, so stale entries are not recovered after the next boot
+        ens_fs_make_space(&ens_fs, 0);
+    } else {
+        uint32_t recovered = recover_storage_information();
+        printk("Recovered %u contacts since last checkpoint\n", recovered);
+    }
+    init_sector_timestamps();
+
+    rc = record_bloom_init();
+    if (rc < 0) {
+        printk("Cannot init bloom filter (err %d)\n", rc);
+        return rc;
+    }
+    // the snapshot might contain days, whose records are gone by now
+    expire_bloom_partitions();
+    if (rc > 0) {
+        // store the added records, so they do not need to be added again at the next boot
+        k_work_submit_to_queue(&reclaim_work_q, &bloom_snapshot_work);
+    }
+
+    printk("Currently %d contacts stored!\n", record_information.count);
+    printk("Space available: %d\n", FLASH_AREA_SIZE(storage));
+    return 0;
 }
 
 void reset_record_storage() {
@@ -112,6 +348,10 @@ void reset_record_storage() {
     record_information.count = 0;
     record_information.oldest_contact = 0;
     save_storage_information();
+    // erase the first sector, so stale entries are not recovered after the next boot
+    ens_fs_make_space(&ens_fs, 0);
+    init_sector_timestamps();
+    record_bloom_clear();
     k_mutex_unlock(&info_fs_lock);
 }
 
@@ -128,11 +368,15 @@ int add_record(record_t* src) {
     /**
      * Some information about the procedure in this function:
      *      1. we calculate the potential next sn and storage id
-     *      2. we try to write our entry
+     *      2. we try to append our entry (it might be staged in RAM until its program page is full)
      *          2.1 if write was successful, goto 5., otherwise continue at 3.
-     *      3. if our id is already in use, we request the fs to make some space
+     *      3. if our id is already in use, we request the fs to make some space (usually, the reclaim worker already
+     *         erased the sector ahead of time, see reclaim_work_handler)
      *      4. after making space, we adjust our storage information and try to write again
-     *      5. we actually "increment" our stored contact information
+     *      5. we add the record to the bloom filter partition of its day and actually "increment" our stored contact
+     *         information
+     *      6. we checkpoint our information to flash, if we started a new sector or added enough records since the
+     *         last checkpoint (records in between are recovered at boot, see recover_storage_information)
      *
      * This order (first erase storage, then increment information) is important, because like this we keep a constant
      * state of our information about the stored contacts in combination with correct state of our flash.
@@ -143,11 +387,10 @@ int add_record(record_t* src) {
     k_mutex_lock(&info_fs_lock, K_FOREVER);
 
     // Check, if next sn would be at start of page
-    rec.sn =
-        get_latest_sequence_number() == get_oldest_sequence_number() ? 0 : sn_increment(get_latest_sequence_number());
+    rec.sn = get_next_sequence_number();
     storage_id_t potential_next_id = convert_sn_to_storage_id(rec.sn);
-    // write our entry to flash and check, if the current entry is already in use
-    int rc = ens_fs_write(&ens_fs, potential_next_id, &rec);
+    // append our entry to flash and check, if the current entry is already in use
+    int rc = ens_fs_append(&ens_fs, potential_next_id, &rec);
     // if our error does NOT indicate, that this address is already in use, we just goto end and do nothing
     if (rc && rc != -ENS_ADDRINU) {
         // TODO: maybe also increment, if there is an internal error?
@@ -160,17 +403,29 @@ int add_record(record_t* src) {
             rc = deletedRecordsCount;
             // we still need to increment our information, so we are not at the exact same id the entire time
             goto inc;
-        } else if (deletedRecordsCount > 0 && get_num_records() == CONFIG_ENS_MAX_CONTACTS) {
+        } else if (deletedRecordsCount > 0) {
+            sector_timestamps[get_sector_for_sn(rec.sn)] = TIMESTAMP_UNKNOWN;
+        }
+        if (deletedRecordsCount > 0 && get_num_records() == CONFIG_ENS_MAX_CONTACTS) {
             record_information.count -= deletedRecordsCount;
             record_information.oldest_contact = sn_increment_by(record_information.oldest_contact, deletedRecordsCount);
+            expire_bloom_partitions();
         }
         // after creating some space, try to write again
-        rc = ens_fs_write(&ens_fs, potential_next_id, &rec);
+        rc = ens_fs_append(&ens_fs, potential_next_id, &rec);
         if (rc) {
             goto inc;
         }
     }
 
+    if (potential_next_id % get_records_per_sector() == 0) {
+        sector_timestamps[get_sector_for_sn(rec.sn)] = rec.timestamp;
+    }
+    if (record_bloom_add(&rec)) {
+        // a new day started, snapshot the filter in the background
+        k_work_submit_to_queue(&reclaim_work_q, &bloom_snapshot_work);
+    }
+
 inc:
     // check, how we need to update our storage information
     if (record_information.count >= CONFIG_ENS_MAX_CONTACTS) {
@@ -178,7 +433,19 @@ inc:
     } else {
         record_information.count++;
     }
-    save_storage_information();
+    records_since_checkpoint++;
+    if (records_since_checkpoint >= CONFIG_ENS_STORAGE_CHECKPOINT_INTERVAL ||
+        potential_next_id % get_records_per_sector() == 0) {
+        // records referenced by a checkpoint have to be in flash
+        ens_fs_flush(&ens_fs);
+        save_storage_information();
+    }
+
+    // make sure, there is always some erased space ahead of us
+    if (count_erased_ahead(convert_sn_to_storage_id(get_next_sequence_number()), CONFIG_ENS_RECLAIM_LOW_WATER) <
+        CONFIG_ENS_RECLAIM_LOW_WATER) {
+        k_work_submit_to_queue(&reclaim_work_q, &reclaim_work);
+    }
 
 end:
     k_mutex_unlock(&info_fs_lock);
@@ -240,6 +507,8 @@ int ens_records_iterator_init_range(record_iterator_t* iterator,
                                     record_sequence_number_t* opt_end) {
     // prevent any changes during initialization
     int rc = get_sequence_number_interval(&iterator->sn_next, &iterator->sn_end);
+    iterator->buffered = 0;
+    iterator->buffer_pos = 0;
     if (rc == 0) {
         iterator->finished = false;
 
@@ -353,6 +622,86 @@ int find_sn_via_binary_search(record_sequence_number_t* sn_dest,
     return 0;
 }
 
+/**
+ * Find an entry for the timestamp with our timestamp index. The index narrows the search down to a single sector, whose
+ * records are then read with a single flash read.
+ *
+ * @return 0 on success, -ENS_NOENT if our index does not cover the range, a negative error if the sector cannot be read
+ */
+static int find_sn_via_index(record_sequence_number_t* sn_dest,
+                             uint32_t target,
+                             enum record_timestamp_search_mode search_mode) {
+    int rc = 0;
+    k_mutex_lock(&info_fs_lock, K_FOREVER);
+
+    record_sequence_number_t oldest;
+    record_sequence_number_t latest;
+    if (get_sequence_number_interval(&oldest, &latest)) {
+        rc = -ENS_NOENT;
+        goto end;
+    }
+
+    // sector k starts at sn first_sector_sn + k * records_per_sector (the first one at oldest)
+    uint32_t records_per_sector = get_records_per_sector();
+    record_sequence_number_t first_sector_sn = oldest - oldest % records_per_sector;
+    uint32_t sector_count = sn_distance(first_sector_sn, latest) / records_per_sector + 1;
+
+    // binary search for the last sector k, whose first timestamp is lower (MIN) or lower/equal (MAX) than target
+    int32_t lo = -1;
+    int32_t hi = sector_count - 1;
+    while (lo < hi) {
+        int32_t mid = lo + (hi - lo + 1) / 2;
+        uint32_t ts = sector_timestamps[get_sector_for_sn(sn_increment_by(first_sector_sn, mid * records_per_sector))];
+        if (ts == TIMESTAMP_UNKNOWN) {
+            rc = -ENS_NOENT;
+            goto end;
+        }
+        if (ts < target || (search_mode == RECORD_TIMESTAMP_SEARCH_MODE_MAX && ts == target)) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    if (lo < 0) {
+        // all records are after our target
+        *sn_dest = oldest;
+        goto end;
+    }
+
+    // read all stored records of sector lo at once
+    record_sequence_number_t sector_sn = lo == 0 ? oldest : sn_increment_by(first_sector_sn, lo * records_per_sector);
+    uint32_t count = MIN(records_per_sector - sector_sn % records_per_sector, sn_distance(sector_sn, latest) + 1);
+    int loaded = ens_fs_read_range(&ens_fs, convert_sn_to_storage_id(sector_sn), count, sector_buffer);
+    record_t* records = (record_t*)sector_buffer;
+    if (loaded < 0) {
+        // the caller falls back to searching the flash
+        rc = loaded;
+        goto end;
+    }
+
+    if (search_mode == RECORD_TIMESTAMP_SEARCH_MODE_MIN) {
+        // the first record with at least our target, or the start of the next sector
+        for (int i = 0; i < loaded; i++) {
+            if (records[i].timestamp >= target) {
+                *sn_dest = records[i].sn;
+                goto end;
+            }
+        }
+        *sn_dest = lo + 1 < sector_count ? sn_increment_by(sector_sn, count) : latest;
+    } else {
+        // the last record with at most our target
+        *sn_dest = sector_sn;
+        for (int i = 0; i < loaded && records[i].timestamp <= target; i++) {
+            *sn_dest = records[i].sn;
+        }
+    }
+
+end:
+    k_mutex_unlock(&info_fs_lock);
+    return rc;
+}
+
 // TODO: This iterator does neither check if the sequence numbers wrapped around while iteration. As a result, first
 // results could have later timestamps than following entries
 int ens_records_iterator_init_timerange(record_iterator_t* iterator, time_t* ts_start, time_t* ts_end) {
@@ -364,8 +713,16 @@ int ens_records_iterator_init_timerange(record_iterator_t* iterator, time_t* ts_
         return 1;
     }
 
+    // a record of our range is followed only by records with at least its timestamp - RECORD_MAX_APPEND_DELAY and
+    // preceded only by ones with at most its timestamp + RECORD_MAX_APPEND_DELAY, so our searches find all of them with
+    // the widened range
     if (ts_start) {
-        int rc = find_sn_via_binary_search(&oldest_sn, *ts_start, RECORD_TIMESTAMP_SEARCH_MODE_MIN);
+        uint32_t target = *ts_start > RECORD_MAX_APPEND_DELAY ? *ts_start - RECORD_MAX_APPEND_DELAY : 0;
+        int rc = find_sn_via_index(&oldest_sn, target, RECORD_TIMESTAMP_SEARCH_MODE_MIN);
+        if (rc) {
+            // fall back to searching the flash
+            rc = find_sn_via_binary_search(&oldest_sn, target, RECORD_TIMESTAMP_SEARCH_MODE_MIN);
+        }
         if (rc) {
             return rc;
         }
@@ -374,7 +731,11 @@ int ens_records_iterator_init_timerange(record_iterator_t* iterator, time_t* ts_
     }
 
     if (ts_end) {
-        int rc = find_sn_via_binary_search(&newest_sn, *ts_end, RECORD_TIMESTAMP_SEARCH_MODE_MAX);
+        uint32_t target = MIN((uint64_t)*ts_end + RECORD_MAX_APPEND_DELAY, UINT32_MAX);
+        int rc = find_sn_via_index(&newest_sn, target, RECORD_TIMESTAMP_SEARCH_MODE_MAX);
+        if (rc) {
+            rc = find_sn_via_binary_search(&newest_sn, target, RECORD_TIMESTAMP_SEARCH_MODE_MAX);
+        }
         if (rc) {
             return rc;
         }
@@ -385,27 +746,38 @@ int ens_records_iterator_init_timerange(record_iterator_t* iterator, time_t* ts_
     return ens_records_iterator_init_range(iterator, &oldest_sn, &newest_sn);
 }
 
-record_t* ens_records_iterator_next(record_iterator_t* iter) {
-    record_t* next = NULL;
-
-    while (next == NULL && !iter->finished) {
-        record_t contact;
-        // try to load the next contact
-        int res = load_record(&contact, iter->sn_next);
-
-        if (!res) {
-            next = &iter->current;
-            memcpy(next, &contact, sizeof(record_t));
-        }
+/**
+ * Read the next records of the iterator into its buffer, at most until the end of the ring.
+ */
+static void prefetch_records(record_iterator_t* iter) {
+    storage_id_t id = convert_sn_to_storage_id(iter->sn_next);
+    uint32_t remaining = sn_distance(iter->sn_next, iter->sn_end) + 1;
+    uint32_t count = MIN(sizeof(iter->buffer) / ens_fs.interal_size, remaining);
+    count = MIN(count, CONFIG_ENS_MAX_CONTACTS - id);
+
+    // records we cannot load are skipped
+    int rc = ens_fs_read_range(&ens_fs, id, count, iter->buffer);
+    iter->buffered = rc > 0 ? rc : 0;
+    iter->buffer_pos = 0;
+
+    if (count == remaining) {
+        iter->finished = true;  // this iterator will finish after the buffered records
+    } else {
+        iter->sn_next = sn_increment_by(iter->sn_next, count);
+    }
+}
 
-        if (sn_equal(iter->sn_next, iter->sn_end)) {
-            iter->finished = true;  // this iterator will finish after this execution
-        } else {
-            // increase the current sn
-            iter->sn_next = sn_increment(iter->sn_next);
+record_t* ens_records_iterator_next(record_iterator_t* iter) {
+    while (iter->buffer_pos >= iter->buffered) {
+        if (iter->finished) {
+            return NULL;
         }
+        prefetch_records(iter);
     }
 
+    record_t* next = &iter->current;
+    memcpy(next, &iter->buffer[iter->buffer_pos * sizeof(record_t)], sizeof(record_t));
+    iter->buffer_pos++;
     return next;
 }
 
@@ -415,6 +787,8 @@ int ens_record_iterator_clear(record_iterator_t* iter) {
     iter->sn_next = 0;
     iter->sn_end = 0;
     memset(&iter->current, 0, sizeof(iter->current));
+    iter->buffered = 0;
+    iter->buffer_pos = 0;
     return 0;
 }
 
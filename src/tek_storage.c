@@ -1,26 +1,224 @@
+#include <errno.h>
+#include <storage/flash_map.h>
 #include <string.h>
+#include <zephyr.h>
+
 #include "tek_storage.h"
+#include "utility/ens_fs.h"
+
+typedef struct stored_tek {
+    uint32_t sn;  // sequence number, gives the order of the keys and their position in the ring
+    tek_t tek;
+} __packed stored_tek_t;
+
+/**
+ * Latest key of a period. The directory has a slot per day, so a slot is reused for the period TEK_STORAGE_DAYS
+ * later.
+ */
+typedef struct tek_directory_entry {
+    bool valid;
+    ENIntervalNumber rolling_start;
+    uint32_t sn;
+} tek_directory_entry_t;
+
+static ens_fs_t tek_fs;
+static struct k_mutex tek_lock;
+static tek_directory_entry_t directory[TEK_STORAGE_DAYS];
+static uint32_t next_sn;
+
+static inline uint32_t get_keys_per_sector() {
+    return tek_fs.sector_size / tek_fs.interal_size;
+}
+
+static inline uint32_t get_capacity() {
+    return tek_fs.sector_count * get_keys_per_sector();
+}
+
+static inline uint64_t get_id(uint32_t sn) {
+    return sn % get_capacity();
+}
+
+static inline ENIntervalNumber get_rolling_start(const tek_t* tek) {
+    return en_get_interval_number_at_period_start(tek->timestamp);
+}
+
+static inline tek_directory_entry_t* get_slot(ENIntervalNumber rolling_start) {
+    return &directory[(rolling_start / EN_TEK_ROLLING_PERIOD) % TEK_STORAGE_DAYS];
+}
+
+/**
+ * Delete the key of the given slot from flash and the directory.
+ */
+static void remove_entry(tek_directory_entry_t* entry) {
+    if (entry->valid) {
+        ens_fs_delete(&tek_fs, get_id(entry->sn));
+        entry->valid = false;
+    }
+}
+
+/**
+ * Delete all keys, which are TEK_STORAGE_DAYS or more older than the given period.
+ */
+static void expire_keys(ENIntervalNumber rolling_start) {
+    for (int i = 0; i < TEK_STORAGE_DAYS; i++) {
+        if (directory[i].valid &&
+            directory[i].rolling_start + TEK_STORAGE_DAYS * EN_TEK_ROLLING_PERIOD <= rolling_start) {
+            remove_entry(&directory[i]);
+        }
+    }
+}
+
+/**
+ * Make sure, the entry of the next key is erased, erasing its sector at the start of a new round. Erasing a sector
+ * drops the keys of all slots stored in it, which only happens for expired keys as long as less than
+ * (sector count - 1) * keys per sector keys are added within TEK_STORAGE_DAYS.
+ */
+static int make_space_for_next() {
+    uint64_t id = get_id(next_sn);
+    // keys are written in order, so within a sector only deleted newer keys can be in use, which we skip
+    while (!ens_fs_is_erased(&tek_fs, id) && id % get_keys_per_sector()) {
+        id = get_id(++next_sn);
+    }
+    if (ens_fs_is_erased(&tek_fs, id)) {
+        return 0;
+    }
+    if ((int)ens_fs_make_space(&tek_fs, id) < 0) {
+        return -EIO;
+    }
+    for (int i = 0; i < TEK_STORAGE_DAYS; i++) {
+        if (directory[i].valid && get_id(directory[i].sn) / get_keys_per_sector() == id / get_keys_per_sector()) {
+            directory[i].valid = false;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Build the directory from all keys in flash.
+ */
+static void load_directory() {
+    ENIntervalNumber newest = 0;
+    bool any = false;
+    memset(directory, 0, sizeof(directory));
+    next_sn = 0;
+
+    for (uint64_t id = 0; id < get_capacity(); id++) {
+        if (ens_fs_is_erased(&tek_fs, id)) {
+            // all following entries of the sector are erased as well
+            id += get_keys_per_sector() - id % get_keys_per_sector() - 1;
+            continue;
+        }
+        stored_tek_t stored;
+        if (ens_fs_read(&tek_fs, id, &stored) || get_id(stored.sn) != id) {
+            continue;
+        }
+
+        ENIntervalNumber rolling_start = get_rolling_start(&stored.tek);
+        tek_directory_entry_t* entry = get_slot(rolling_start);
+        if (!entry->valid || (int32_t)(stored.sn - entry->sn) > 0) {
+            entry->valid = true;
+            entry->rolling_start = rolling_start;
+            entry->sn = stored.sn;
+        }
+        if (!any || (int32_t)(stored.sn - next_sn) >= 0) {
+            next_sn = stored.sn + 1;
+        }
+        newest = MAX(newest, rolling_start);
+        any = true;
+    }
+    expire_keys(newest);
+}
 
 int tek_storage_init(bool clean) {
+    int rc = ens_fs_init(&tek_fs, FLASH_AREA_ID(tek_storage), sizeof(stored_tek_t));
+    if (rc) {
+        printk("Cannot init tek ens_fs (err %d)\n", rc);
+        return rc;
+    }
+    if (tek_fs.sector_count < 2) {
+        // erasing the only sector would drop all keys
+        printk("Tek storage needs at least two sectors\n");
+        return -EINVAL;
+    }
+    k_mutex_init(&tek_lock);
+
+    if (clean) {
+        for (uint64_t id = 0; id < get_capacity(); id += get_keys_per_sector()) {
+            ens_fs_make_space(&tek_fs, id);
+        }
+    }
+    load_directory();
     return 0;
 }
 
 int tek_storage_add(tek_t* src) {
-    // TODO
-    return -1;
+    ENIntervalNumber rolling_start = get_rolling_start(src);
+    tek_directory_entry_t* entry = get_slot(rolling_start);
+    stored_tek_t stored;
+    int rc = 0;
+
+    k_mutex_lock(&tek_lock, K_FOREVER);
+    if (entry->valid && entry->rolling_start > rolling_start) {
+        // the slot already belongs to a newer period, so the key is expired
+        rc = -EINVAL;
+        goto end;
+    }
+
+    rc = make_space_for_next();
+    if (rc) {
+        goto end;
+    }
+    stored.sn = next_sn;
+    memcpy(&stored.tek, src, sizeof(stored.tek));
+    if (ens_fs_write(&tek_fs, get_id(stored.sn), &stored)) {
+        rc = -EIO;
+        goto end;
+    }
+    next_sn++;
+
+    // replaces an older key of the same period or an expired one
+    remove_entry(entry);
+    entry->valid = true;
+    entry->rolling_start = rolling_start;
+    entry->sn = stored.sn;
+    expire_keys(rolling_start);
+
+end:
+    k_mutex_unlock(&tek_lock);
+    return rc;
 }
 
 int tek_storage_delete(tek_t* src) {
-    // TODO
-    return -1;
+    tek_directory_entry_t* entry = get_slot(get_rolling_start(src));
+    stored_tek_t stored;
+    int rc = -ENOENT;
+
+    k_mutex_lock(&tek_lock, K_FOREVER);
+    if (entry->valid && entry->rolling_start == get_rolling_start(src) &&
+        ens_fs_read(&tek_fs, get_id(entry->sn), &stored) == 0 &&
+        memcmp(&stored.tek.tek, &src->tek, sizeof(src->tek)) == 0) {
+        remove_entry(entry);
+        rc = 0;
+    }
+    k_mutex_unlock(&tek_lock);
+    return rc;
 }
 
-/**
- * Returns 0 on success, else non zero (if none available)
- * TODO: This is not really implemented...
- */
 int tek_storage_get_latest_at_ts(tek_t* dest, uint32_t timestamp) {
-    dest->timestamp = timestamp;
-    memset(&dest->tek, 0, sizeof(dest->tek));
-    return 0;
-}
\ No newline at end of file
+    ENIntervalNumber rolling_start = en_get_interval_number_at_period_start(timestamp);
+    tek_directory_entry_t* entry = get_slot(rolling_start);
+    stored_tek_t stored;
+    int rc = -ENOENT;
+
+    k_mutex_lock(&tek_lock, K_FOREVER);
+    expire_keys(rolling_start);
+    if (entry->valid && entry->rolling_start == rolling_start) {
+        rc = ens_fs_read(&tek_fs, get_id(entry->sn), &stored) ? -EIO : 0;
+    }
+    k_mutex_unlock(&tek_lock);
+
+    if (rc == 0) {
+        memcpy(dest, &stored.tek, sizeof(*dest));
+    }
+    return rc;
+}
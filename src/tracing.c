@@ -9,17 +9,21 @@
 #include <sys/printk.h>
 #include <sys/util.h>
 #include <string.h>
+#include <errno.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
 #include <kernel.h>
+#include <sys/atomic.h>
 
 #include "exposure-notification.h"
 #include "tracing.h"
 #include "record_storage.h"
 #include "tek_storage.h"
+#include "encounter.h"
 
 #include "utility/util.h"
+#include "utility/en_key_cache.h"
 
 #define COVID_ENS (0xFD6F)
 
@@ -32,6 +36,9 @@ typedef ENIntervalIdentifier ENIntervalIdentifier;
 #define SCAN_DURATION_MS 2000
 #define ADV_INTERVAL_MS 250
 
+#define CONTACT_QUEUE_MASK (CONFIG_ENS_CONTACT_QUEUE_SIZE - 1)
+#define CONTACT_STORAGE_THREAD_PRIO 7
+
 
 K_TIMER_DEFINE(rpi_timer, NULL, NULL);
 K_TIMER_DEFINE(scan_timer, NULL, NULL);
@@ -39,6 +46,94 @@ K_TIMER_DEFINE(scan_timer, NULL, NULL);
 static int on_rpi();
 static int on_scan();
 
+/**
+ * Lock-free single-producer single-consumer queue of received contacts. scan_cb is the only producer and runs in the
+ * Bluetooth RX context, the contact storage thread is the only consumer. It aggregates the contacts into encounters
+ * and does all the flash work.
+ * Both indices are free running and only written by their owner.
+ */
+static record_t contact_queue[CONFIG_ENS_CONTACT_QUEUE_SIZE];
+static atomic_t contact_queue_head = ATOMIC_INIT(0);  // next index to write
+static atomic_t contact_queue_tail = ATOMIC_INIT(0);  // next index to read
+static atomic_t contact_queue_high_water = ATOMIC_INIT(0);
+static atomic_t contact_queue_dropped = ATOMIC_INIT(0);
+K_SEM_DEFINE(contact_queue_sem, 0, 1);
+
+// requests the contact storage thread to store all open encounters
+static atomic_t encounter_flush_requested = ATOMIC_INIT(0);
+K_SEM_DEFINE(encounter_flush_sem, 0, 1);
+#define ENCOUNTER_FLUSH_TIMEOUT K_SECONDS(5)
+
+static bool contact_queue_push(const record_t* record) {
+    atomic_val_t head = atomic_get(&contact_queue_head);
+    atomic_val_t fill = head - atomic_get(&contact_queue_tail);
+    if (fill >= CONFIG_ENS_CONTACT_QUEUE_SIZE) {
+        atomic_inc(&contact_queue_dropped);
+        return false;
+    }
+
+    memcpy(&contact_queue[head & CONTACT_QUEUE_MASK], record, sizeof(record_t));
+    // publish the record to the consumer
+    atomic_set(&contact_queue_head, head + 1);
+
+    if (fill + 1 > atomic_get(&contact_queue_high_water)) {
+        atomic_set(&contact_queue_high_water, fill + 1);
+    }
+    k_sem_give(&contact_queue_sem);
+    return true;
+}
+
+static void contact_storage_thread_entry(void* p1, void* p2, void* p3) {
+    while (1) {
+        // we also wake up regularly to store expired encounters
+        k_sem_take(&contact_queue_sem, K_SECONDS(CONFIG_ENS_ENCOUNTER_TIMEOUT / 2));
+
+        // aggregate everything, that was queued so far
+        atomic_val_t tail = atomic_get(&contact_queue_tail);
+        atomic_val_t head = atomic_get(&contact_queue_head);
+        while (tail != head) {
+            encounter_add_sighting(&contact_queue[tail & CONTACT_QUEUE_MASK]);
+            // hand the slot back to the producer
+            tail++;
+            atomic_set(&contact_queue_tail, tail);
+            head = atomic_get(&contact_queue_head);
+        }
+
+        int stored;
+        if (atomic_clear(&encounter_flush_requested)) {
+            stored = encounter_flush_all();
+            k_sem_give(&encounter_flush_sem);
+        } else {
+            stored = encounter_flush_expired(time_get_unix_seconds());
+        }
+        if (stored) {
+            printk("Stored %d encounters\n", stored);
+        }
+    }
+}
+
+K_THREAD_DEFINE(contact_storage_thread,
+                CONFIG_ENS_CONTACT_STORAGE_STACK_SIZE,
+                contact_storage_thread_entry,
+                NULL,
+                NULL,
+                NULL,
+                CONTACT_STORAGE_THREAD_PRIO,
+                0,
+                0);
+
+int tracing_flush_encounters(void) {
+    k_sem_reset(&encounter_flush_sem);
+    atomic_set(&encounter_flush_requested, 1);
+    k_sem_give(&contact_queue_sem);
+    return k_sem_take(&encounter_flush_sem, ENCOUNTER_FLUSH_TIMEOUT);
+}
+
+void tracing_get_contact_queue_stats(uint32_t* high_water, uint32_t* dropped) {
+    *high_water = atomic_get(&contact_queue_high_water);
+    *dropped = atomic_get(&contact_queue_dropped);
+}
+
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
 #include <bluetooth/hci_vs.h>
@@ -190,6 +285,41 @@ uint32_t tracing_run()
 
 
 
+/**
+ * Our own identifiers and encrypted metadata for all intervals of the current period. They only depend on the TEK, so
+ * we derive them in one batch, whenever the TEK or the period changes, and the rotation just copies them.
+ */
+static struct {
+    bool valid;
+    ENPeriodKey tek;                 // the TEK, the cache was built with
+    ENIntervalNumber rolling_start;  // first interval of the cached period
+    ENIntervalIdentifier rpis[EN_TEK_ROLLING_PERIOD];
+    associated_encrypted_metadata_t aems[EN_TEK_ROLLING_PERIOD];
+} rpi_cache;
+
+static int build_rpi_cache(const tek_t* tek, ENIntervalNumber rolling_start) {
+    rpi_cache.valid = false;
+    en_key_context_t* keys = en_key_cache_get(&tek->tek);
+    if (!keys) {
+        return -EIO;
+    }
+    int err = en_batch_derive_with_key(rpi_cache.rpis, &keys->rpi_key, rolling_start, NULL, EN_TEK_ROLLING_PERIOD);
+    if (err) {
+        return err;
+    }
+
+    const ENPeriodMetadataEncryptionKey* pmek = en_key_cache_get_pmek(keys);
+    for (int i = 0; i < EN_TEK_ROLLING_PERIOD; i++) {
+        en_encrypt_interval_metadata(pmek, &rpi_cache.rpis[i], (unsigned char*)&bt_metadata,
+                                     (unsigned char*)&rpi_cache.aems[i], sizeof(associated_encrypted_metadata_t));
+    }
+
+    memcpy(&rpi_cache.tek, &tek->tek, sizeof(rpi_cache.tek));
+    rpi_cache.rolling_start = rolling_start;
+    rpi_cache.valid = true;
+    return 0;
+}
+
 int on_rpi() {
 
     printk("\n----------------------------------------\n\n");
@@ -201,28 +331,33 @@ int on_rpi() {
     tek_t tek;
     int err = tek_storage_get_latest_at_ts(&tek, currentTime);
 
+    if (err == -ENOENT) {
+        // we start a new period
+        tek.timestamp = en_get_interval_number_at_period_start(currentTime) * EN_INTERVAL_LENGTH;
+        en_generate_period_key(&tek.tek);
+        err = tek_storage_add(&tek);
+    }
+
     if (err != 0) {
         printk("ERROR: COULD NOT DETERMINE TEK!!!\n");
         return err;
     }
 
     ENIntervalNumber currentInterval = en_get_interval_number(currentTime);
+    ENIntervalNumber rollingStart = en_get_interval_number_at_period_start(currentTime);
+
+    // on a new TEK or period, we derive the identifiers and re-encrypt the metadata for the whole period
+    if (!rpi_cache.valid || rpi_cache.rolling_start != rollingStart ||
+        memcmp(&rpi_cache.tek, &tek.tek, sizeof(rpi_cache.tek)) != 0) {
+        err = build_rpi_cache(&tek, rollingStart);
+        if (err) {
+            printk("ERROR: COULD NOT DERIVE RPIS (err %d)\n", err);
+            return err;
+        }
+    }
 
-    // we now generate the new interval identifier and re-encrypt the metadata
-    // TODO: The period identifier key and the MetadataEncryptionKey do not need to be derived everytime!
-
-    ENPeriodMetadataEncryptionKey periodMetadataEncryptionKey;
-    ENPeriodIdentifierKey pik;
-    ENIntervalIdentifier intervalIdentifier;
-    en_derive_period_identifier_key(&pik, &tek.tek);
-    en_derive_interval_identifier(&intervalIdentifier, &pik, currentInterval);
-
-
-    associated_encrypted_metadata_t encryptedMetadata;
-
-    en_derive_period_metadata_encryption_key(&periodMetadataEncryptionKey, &tek.tek);
-    en_encrypt_interval_metadata(&periodMetadataEncryptionKey, &intervalIdentifier, (unsigned char*)&bt_metadata, (unsigned char*)&encryptedMetadata, sizeof(associated_encrypted_metadata_t));
-
+    ENIntervalIdentifier* intervalIdentifier = &rpi_cache.rpis[currentInterval - rollingStart];
+    associated_encrypted_metadata_t* encryptedMetadata = &rpi_cache.aems[currentInterval - rollingStart];
 
     // broadcast intervalIdentifier plus encryptedMetada according to specs
     //printk("\n----------------------------------------\n\n");
@@ -232,14 +367,14 @@ int on_rpi() {
     print_rpi((ENIntervalIdentifier *)&tek.tek);
     printk(", ");
     printk("RPI: ");
-    print_rpi((ENIntervalIdentifier *)&intervalIdentifier);
+    print_rpi(intervalIdentifier);
     printk(", ");
     printk("AEM: ");
-    print_aem(&encryptedMetadata);
+    print_aem(encryptedMetadata);
     printk("\n");
 
-    memcpy(&covid_adv_svd.rolling_proximity_identifier, &intervalIdentifier, sizeof(ENIntervalIdentifier));
-    memcpy(&covid_adv_svd.associated_encrypted_metadata, &encryptedMetadata, sizeof(associated_encrypted_metadata_t));
+    memcpy(&covid_adv_svd.rolling_proximity_identifier, intervalIdentifier, sizeof(ENIntervalIdentifier));
+    memcpy(&covid_adv_svd.associated_encrypted_metadata, encryptedMetadata, sizeof(associated_encrypted_metadata_t));
     return 0;
 }
 
@@ -283,10 +418,8 @@ static void scan_cb(const bt_addr_le_t *addr, int8_t rssi, uint8_t adv_type, str
                     memcpy(&record.associated_encrypted_metadata, &rx_adv->associated_encrypted_metadata, sizeof(record.associated_encrypted_metadata));
                     memcpy(&record.rolling_proximity_identifier, &rx_adv->rolling_proximity_identifier, sizeof(record.rolling_proximity_identifier));
                     memcpy(&record.timestamp, &timestamp, sizeof(record.timestamp));
-                    int rc = add_record(&record);
-                    if (rc != 0) {
-                        printk("ERROR: Storing record failed (err %d)\n", rc);
-                    }
+                    // the storage thread takes care of the flash
+                    contact_queue_push(&record);
                 }
             }
             net_buf_simple_pull(buf, len - 1); //consume the rest, note we already consumed one byte via net_buf_simple_pull_u8(buf)
@@ -296,7 +429,7 @@ static void scan_cb(const bt_addr_le_t *addr, int8_t rssi, uint8_t adv_type, str
 
 int on_scan() {
 
-    uint32_t num_devs = get_num_records();
+    atomic_val_t num_devs = atomic_get(&contact_queue_head);
     printk("Scanning for devices...\n");
     int err = 0;
     err = bt_le_scan_start(&scan_param, scan_cb);
@@ -315,6 +448,9 @@ int on_scan() {
         return err;
     }
 
-    printk("Scanning done... %u devices found\n", get_num_records()-num_devs);
+    uint32_t high_water, dropped;
+    tracing_get_contact_queue_stats(&high_water, &dropped);
+    printk("Scanning done... %u devices found (queue high water %u, dropped %u)\n",
+           (uint32_t)(atomic_get(&contact_queue_head) - num_devs), high_water, dropped);
     return 0;
 }
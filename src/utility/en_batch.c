@@ -0,0 +1,517 @@
+#include <string.h>
+#include <zephyr.h>
+
+#include "utility/en_batch.h"
+
+// padded data of the identifier derivation: "EN-RPI", six zero bytes and the interval number in little endian
+#define RPI_INFO "EN-RPI"
+#define RPI_INTERVAL_OFFSET 12
+
+#if EN_BATCH_HOST && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define EN_BATCH_AESNI 1
+#else
+#define EN_BATCH_AESNI 0
+#endif
+
+#if EN_BATCH_AESNI
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#if EN_BATCH_HOST
+#include <mbedtls/platform_util.h>
+#endif
+
+static inline ENIntervalNumber get_interval(ENIntervalNumber first, const ENIntervalNumber* intervals, size_t i) {
+    return intervals ? intervals[i] : first + i;
+}
+
+#if EN_BATCH_AESNI
+
+// amount of blocks we encrypt interleaved to hide the latency of the AES instructions
+#define AESNI_BLOCKS 8
+
+static bool has_aesni(void) {
+    static int supported = -1;
+    if (supported < 0) {
+        unsigned int eax, ebx, ecx, edx;
+        supported = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES);
+    }
+    return supported;
+}
+
+__attribute__((target("aes,sse2"))) static inline __m128i aesni_expand_key(__m128i key, __m128i assist) {
+    assist = _mm_shuffle_epi32(assist, _MM_SHUFFLE(3, 3, 3, 3));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, assist);
+}
+
+// the round constant has to be an immediate
+#define AESNI_EXPAND(rk, i, rcon) rk[i] = aesni_expand_key(rk[i - 1], _mm_aeskeygenassist_si128(rk[i - 1], rcon))
+
+__attribute__((target("aes,sse2"))) static void expand_key_aesni(en_batch_key_t* key,
+                                                                 const ENPeriodIdentifierKey* pik) {
+    __m128i rk[EN_BATCH_AES_ROUNDS + 1];
+    rk[0] = _mm_loadu_si128((const __m128i*)pik->b);
+    AESNI_EXPAND(rk, 1, 0x01);
+    AESNI_EXPAND(rk, 2, 0x02);
+    AESNI_EXPAND(rk, 3, 0x04);
+    AESNI_EXPAND(rk, 4, 0x08);
+    AESNI_EXPAND(rk, 5, 0x10);
+    AESNI_EXPAND(rk, 6, 0x20);
+    AESNI_EXPAND(rk, 7, 0x40);
+    AESNI_EXPAND(rk, 8, 0x80);
+    AESNI_EXPAND(rk, 9, 0x1b);
+    AESNI_EXPAND(rk, 10, 0x36);
+    for (int r = 0; r <= EN_BATCH_AES_ROUNDS; r++) {
+        _mm_storeu_si128((__m128i*)key->round_keys[r], rk[r]);
+    }
+}
+
+__attribute__((target("aes,sse2"))) static void derive_aesni(ENIntervalIdentifier* rpis,
+                                                             const en_batch_key_t* key,
+                                                             ENIntervalNumber first,
+                                                             const ENIntervalNumber* intervals,
+                                                             size_t count) {
+    __m128i rk[EN_BATCH_AES_ROUNDS + 1];
+    for (int r = 0; r <= EN_BATCH_AES_ROUNDS; r++) {
+        rk[r] = _mm_loadu_si128((const __m128i*)key->round_keys[r]);
+    }
+
+    unsigned char padded[sizeof(ENIntervalIdentifier)] = {0};
+    memcpy(padded, RPI_INFO, sizeof(RPI_INFO) - 1);
+    // the interval is the last little endian word, which is zero in our template
+    __m128i template = _mm_loadu_si128((const __m128i*)padded);
+
+    for (size_t i = 0; i < count; i += AESNI_BLOCKS) {
+        size_t n = MIN(AESNI_BLOCKS, count - i);
+        __m128i blocks[AESNI_BLOCKS];
+        for (size_t k = 0; k < AESNI_BLOCKS; k++) {
+            ENIntervalNumber interval = k < n ? get_interval(first, intervals, i + k) : 0;
+            blocks[k] = _mm_xor_si128(_mm_or_si128(template, _mm_set_epi32((int)interval, 0, 0, 0)), rk[0]);
+        }
+        for (int r = 1; r < EN_BATCH_AES_ROUNDS; r++) {
+            for (size_t k = 0; k < AESNI_BLOCKS; k++) {
+                blocks[k] = _mm_aesenc_si128(blocks[k], rk[r]);
+            }
+        }
+        for (size_t k = 0; k < n; k++) {
+            _mm_storeu_si128((__m128i*)rpis[i + k].b, _mm_aesenclast_si128(blocks[k], rk[EN_BATCH_AES_ROUNDS]));
+        }
+    }
+}
+
+#endif
+
+#if EN_BATCH_HOST
+
+/**
+ * Bitsliced AES: bit i of plane 8 * byte + bit holds the bit of the byte of the state of the i-th block. So we
+ * encrypt BITSLICE_LANES blocks at once with plain logic operations, which works on any host and runs in constant
+ * time.
+ */
+#define BITSLICE_LANES 64
+#define BITSLICE_PLANES (8 * sizeof(ENIntervalIdentifier))
+
+typedef uint64_t bitslice_t;
+
+/**
+ * Apply the AES S-box to the eight planes of a byte, with the circuit of Boyar and Peralta.
+ *
+ * @param q planes of the byte, least significant bit first
+ */
+static void bitslice_sbox(bitslice_t* q) {
+    bitslice_t x0 = q[7], x1 = q[6], x2 = q[5], x3 = q[4], x4 = q[3], x5 = q[2], x6 = q[1], x7 = q[0];
+
+    // top linear transformation
+    bitslice_t y14 = x3 ^ x5;
+    bitslice_t y13 = x0 ^ x6;
+    bitslice_t y9 = x0 ^ x3;
+    bitslice_t y8 = x0 ^ x5;
+    bitslice_t t0 = x1 ^ x2;
+    bitslice_t y1 = t0 ^ x7;
+    bitslice_t y4 = y1 ^ x3;
+    bitslice_t y12 = y13 ^ y14;
+    bitslice_t y2 = y1 ^ x0;
+    bitslice_t y5 = y1 ^ x6;
+    bitslice_t y3 = y5 ^ y8;
+    bitslice_t t1 = x4 ^ y12;
+    bitslice_t y15 = t1 ^ x5;
+    bitslice_t y20 = t1 ^ x1;
+    bitslice_t y6 = y15 ^ x7;
+    bitslice_t y10 = y15 ^ t0;
+    bitslice_t y11 = y20 ^ y9;
+    bitslice_t y7 = x7 ^ y11;
+    bitslice_t y17 = y10 ^ y11;
+    bitslice_t y19 = y10 ^ y8;
+    bitslice_t y16 = t0 ^ y11;
+    bitslice_t y21 = y13 ^ y16;
+    bitslice_t y18 = x0 ^ y16;
+
+    // non-linear section
+    bitslice_t t2 = y12 & y15;
+    bitslice_t t3 = y3 & y6;
+    bitslice_t t4 = t3 ^ t2;
+    bitslice_t t5 = y4 & x7;
+    bitslice_t t6 = t5 ^ t2;
+    bitslice_t t7 = y13 & y16;
+    bitslice_t t8 = y5 & y1;
+    bitslice_t t9 = t8 ^ t7;
+    bitslice_t t10 = y2 & y7;
+    bitslice_t t11 = t10 ^ t7;
+    bitslice_t t12 = y9 & y11;
+    bitslice_t t13 = y14 & y17;
+    bitslice_t t14 = t13 ^ t12;
+    bitslice_t t15 = y8 & y10;
+    bitslice_t t16 = t15 ^ t12;
+    bitslice_t t17 = t4 ^ t14;
+    bitslice_t t18 = t6 ^ t16;
+    bitslice_t t19 = t9 ^ t14;
+    bitslice_t t20 = t11 ^ t16;
+    bitslice_t t21 = t17 ^ y20;
+    bitslice_t t22 = t18 ^ y19;
+    bitslice_t t23 = t19 ^ y21;
+    bitslice_t t24 = t20 ^ y18;
+
+    bitslice_t t25 = t21 ^ t22;
+    bitslice_t t26 = t21 & t23;
+    bitslice_t t27 = t24 ^ t26;
+    bitslice_t t28 = t25 & t27;
+    bitslice_t t29 = t28 ^ t22;
+    bitslice_t t30 = t23 ^ t24;
+    bitslice_t t31 = t22 ^ t26;
+    bitslice_t t32 = t31 & t30;
+    bitslice_t t33 = t32 ^ t24;
+    bitslice_t t34 = t23 ^ t33;
+    bitslice_t t35 = t27 ^ t33;
+    bitslice_t t36 = t24 & t35;
+    bitslice_t t37 = t36 ^ t34;
+    bitslice_t t38 = t27 ^ t36;
+    bitslice_t t39 = t29 & t38;
+    bitslice_t t40 = t25 ^ t39;
+
+    bitslice_t t41 = t40 ^ t37;
+    bitslice_t t42 = t29 ^ t33;
+    bitslice_t t43 = t29 ^ t40;
+    bitslice_t t44 = t33 ^ t37;
+    bitslice_t t45 = t42 ^ t41;
+    bitslice_t z0 = t44 & y15;
+    bitslice_t z1 = t37 & y6;
+    bitslice_t z2 = t33 & x7;
+    bitslice_t z3 = t43 & y16;
+    bitslice_t z4 = t40 & y1;
+    bitslice_t z5 = t29 & y7;
+    bitslice_t z6 = t42 & y11;
+    bitslice_t z7 = t45 & y17;
+    bitslice_t z8 = t41 & y10;
+    bitslice_t z9 = t44 & y12;
+    bitslice_t z10 = t37 & y3;
+    bitslice_t z11 = t33 & y4;
+    bitslice_t z12 = t43 & y13;
+    bitslice_t z13 = t40 & y5;
+    bitslice_t z14 = t29 & y2;
+    bitslice_t z15 = t42 & y9;
+    bitslice_t z16 = t45 & y14;
+    bitslice_t z17 = t41 & y8;
+
+    // bottom linear transformation
+    bitslice_t t46 = z15 ^ z16;
+    bitslice_t t47 = z10 ^ z11;
+    bitslice_t t48 = z5 ^ z13;
+    bitslice_t t49 = z9 ^ z10;
+    bitslice_t t50 = z2 ^ z12;
+    bitslice_t t51 = z2 ^ z5;
+    bitslice_t t52 = z7 ^ z8;
+    bitslice_t t53 = z0 ^ z3;
+    bitslice_t t54 = z6 ^ z7;
+    bitslice_t t55 = z16 ^ z17;
+    bitslice_t t56 = z12 ^ t48;
+    bitslice_t t57 = t50 ^ t53;
+    bitslice_t t58 = z4 ^ t46;
+    bitslice_t t59 = z3 ^ t54;
+    bitslice_t t60 = t46 ^ t57;
+    bitslice_t t61 = z14 ^ t57;
+    bitslice_t t62 = t52 ^ t58;
+    bitslice_t t63 = t49 ^ t58;
+    bitslice_t t64 = z4 ^ t59;
+    bitslice_t t65 = t61 ^ t62;
+    bitslice_t t66 = z1 ^ t63;
+    bitslice_t s0 = t59 ^ t63;
+    bitslice_t s6 = t56 ^ ~t62;
+    bitslice_t s7 = t48 ^ ~t60;
+    bitslice_t t67 = t64 ^ t65;
+    bitslice_t s3 = t53 ^ t66;
+    bitslice_t s4 = t51 ^ t66;
+    bitslice_t s5 = t47 ^ t65;
+    bitslice_t s1 = t64 ^ ~s3;
+    bitslice_t s2 = t55 ^ ~t67;
+
+    q[7] = s0;
+    q[6] = s1;
+    q[5] = s2;
+    q[4] = s3;
+    q[3] = s4;
+    q[2] = s5;
+    q[1] = s6;
+    q[0] = s7;
+}
+
+static uint8_t sbox_byte(uint8_t x) {
+    bitslice_t q[8];
+    for (int i = 0; i < 8; i++) {
+        q[i] = (x >> i) & 1;
+    }
+    bitslice_sbox(q);
+
+    uint8_t y = 0;
+    for (int i = 0; i < 8; i++) {
+        y |= (q[i] & 1) << i;
+    }
+    return y;
+}
+
+static void expand_key_bitsliced(en_batch_key_t* key, const ENPeriodIdentifierKey* pik) {
+    memcpy(key->round_keys[0], pik->b, sizeof(pik->b));
+    uint8_t rcon = 0x01;
+    for (int r = 1; r <= EN_BATCH_AES_ROUNDS; r++) {
+        const uint8_t* prev = key->round_keys[r - 1];
+        uint8_t* rk = key->round_keys[r];
+        rk[0] = prev[0] ^ sbox_byte(prev[13]) ^ rcon;
+        rk[1] = prev[1] ^ sbox_byte(prev[14]);
+        rk[2] = prev[2] ^ sbox_byte(prev[15]);
+        rk[3] = prev[3] ^ sbox_byte(prev[12]);
+        for (int i = 4; i < sizeof(pik->b); i++) {
+            rk[i] = prev[i] ^ rk[i - 4];
+        }
+        rcon = (rcon << 1) ^ ((rcon >> 7) * 0x1b);
+    }
+}
+
+/**
+ * As all blocks share the key, the planes of the round key are either all zeros or all ones.
+ */
+static inline void bitslice_add_round_key(bitslice_t* q, const uint8_t* rk) {
+    for (int p = 0; p < BITSLICE_PLANES; p++) {
+        q[p] ^= -(bitslice_t)((rk[p / 8] >> (p % 8)) & 1);
+    }
+}
+
+static inline void bitslice_sub_bytes(bitslice_t* q) {
+    for (int i = 0; i < sizeof(ENIntervalIdentifier); i++) {
+        bitslice_sbox(&q[8 * i]);
+    }
+}
+
+/**
+ * Byte i of the state is in row i % 4 and column i / 4.
+ */
+static inline void bitslice_shift_rows(bitslice_t* q) {
+    bitslice_t t[BITSLICE_PLANES];
+    memcpy(t, q, sizeof(t));
+    for (int row = 1; row < 4; row++) {
+        for (int col = 0; col < 4; col++) {
+            int from = row + 4 * ((col + row) % 4);
+            memcpy(&q[8 * (row + 4 * col)], &t[8 * from], 8 * sizeof(bitslice_t));
+        }
+    }
+}
+
+static inline void bitslice_xtime(bitslice_t* y, const bitslice_t* x) {
+    y[0] = x[7];
+    y[1] = x[0] ^ x[7];
+    y[2] = x[1];
+    y[3] = x[2] ^ x[7];
+    y[4] = x[3] ^ x[7];
+    y[5] = x[4];
+    y[6] = x[5];
+    y[7] = x[6];
+}
+
+static inline void bitslice_mix_columns(bitslice_t* q) {
+    for (int col = 0; col < 4; col++) {
+        bitslice_t* a = &q[32 * col];
+        bitslice_t out[32];
+        for (int row = 0; row < 4; row++) {
+            const bitslice_t* a0 = &a[8 * row];
+            const bitslice_t* a1 = &a[8 * ((row + 1) % 4)];
+            const bitslice_t* a2 = &a[8 * ((row + 2) % 4)];
+            const bitslice_t* a3 = &a[8 * ((row + 3) % 4)];
+            // 2 * a0 + 3 * a1 + a2 + a3
+            bitslice_t sum[8];
+            for (int i = 0; i < 8; i++) {
+                sum[i] = a0[i] ^ a1[i];
+            }
+            bitslice_xtime(&out[8 * row], sum);
+            for (int i = 0; i < 8; i++) {
+                out[8 * row + i] ^= a1[i] ^ a2[i] ^ a3[i];
+            }
+        }
+        memcpy(a, out, sizeof(out));
+    }
+}
+
+/**
+ * Transpose a 64x64 bit matrix, where bit j of a[i] is the entry of row i and column j.
+ */
+static void transpose64(uint64_t* a) {
+    uint64_t m = 0x00000000ffffffffULL;
+    for (int j = 32; j != 0; j >>= 1, m ^= m << j) {
+        for (int k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+            uint64_t t = ((a[k] >> j) ^ a[k | j]) & m;
+            a[k] ^= t << j;
+            a[k | j] ^= t;
+        }
+    }
+}
+
+static void derive_bitsliced(ENIntervalIdentifier* rpis,
+                             const en_batch_key_t* key,
+                             ENIntervalNumber first,
+                             const ENIntervalNumber* intervals,
+                             size_t count) {
+    for (size_t i = 0; i < count; i += BITSLICE_LANES) {
+        size_t n = MIN(BITSLICE_LANES, count - i);
+
+        // all blocks share the padding, only the interval differs
+        bitslice_t q[BITSLICE_PLANES] = {0};
+        for (int p = 0; p < 8 * (sizeof(RPI_INFO) - 1); p++) {
+            q[p] = -(bitslice_t)((RPI_INFO[p / 8] >> (p % 8)) & 1);
+        }
+        for (size_t k = 0; k < n; k++) {
+            ENIntervalNumber interval = get_interval(first, intervals, i + k);
+            for (int b = 0; b < 32; b++) {
+                q[8 * RPI_INTERVAL_OFFSET + b] |= (bitslice_t)((interval >> b) & 1) << k;
+            }
+        }
+
+        bitslice_add_round_key(q, key->round_keys[0]);
+        for (int r = 1; r <= EN_BATCH_AES_ROUNDS; r++) {
+            bitslice_sub_bytes(q);
+            bitslice_shift_rows(q);
+            if (r < EN_BATCH_AES_ROUNDS) {
+                bitslice_mix_columns(q);
+            }
+            bitslice_add_round_key(q, key->round_keys[r]);
+        }
+
+        // afterwards, q[k] holds the first and q[64 + k] the second half of the k-th block
+        transpose64(q);
+        transpose64(q + 64);
+        for (size_t k = 0; k < n; k++) {
+            for (int b = 0; b < 8; b++) {
+                rpis[i + k].b[b] = q[k] >> (8 * b);
+                rpis[i + k].b[8 + b] = q[64 + k] >> (8 * b);
+            }
+        }
+    }
+}
+
+#endif
+
+int en_batch_key_setup(en_batch_key_t* key, const ENPeriodIdentifierKey* pik) {
+#if EN_BATCH_AESNI
+    if (has_aesni()) {
+        expand_key_aesni(key, pik);
+        return 0;
+    }
+#endif
+#if EN_BATCH_HOST
+    expand_key_bitsliced(key, pik);
+    return 0;
+#else
+    mbedtls_aes_init(&key->aes);
+    int rc = mbedtls_aes_setkey_enc(&key->aes, pik->b, sizeof(pik->b) * 8);
+    if (rc) {
+        mbedtls_aes_free(&key->aes);
+    }
+    return rc;
+#endif
+}
+
+void en_batch_key_clear(en_batch_key_t* key) {
+#if EN_BATCH_HOST
+    mbedtls_platform_zeroize(key, sizeof(*key));
+#else
+    // zeroizes the context as well
+    mbedtls_aes_free(&key->aes);
+#endif
+}
+
+#if !EN_BATCH_HOST
+/**
+ * The mbedtls API (and so the CC310 aes_alt backend) only offers single block ECB operations and the padded data
+ * differs in its little endian interval number, which rules out CTR mode. So we encrypt block by block, but skip the
+ * key setup and the padding of all but the first block.
+ */
+static int derive_mbedtls(ENIntervalIdentifier* rpis,
+                          en_batch_key_t* key,
+                          ENIntervalNumber first,
+                          const ENIntervalNumber* intervals,
+                          size_t count) {
+    unsigned char padded[sizeof(ENIntervalIdentifier)] = {0};
+    memcpy(padded, RPI_INFO, sizeof(RPI_INFO) - 1);
+    for (size_t i = 0; i < count; i++) {
+        ENIntervalNumber interval = get_interval(first, intervals, i);
+        padded[RPI_INTERVAL_OFFSET] = interval & 0xff;
+        padded[RPI_INTERVAL_OFFSET + 1] = (interval >> 8) & 0xff;
+        padded[RPI_INTERVAL_OFFSET + 2] = (interval >> 16) & 0xff;
+        padded[RPI_INTERVAL_OFFSET + 3] = (interval >> 24) & 0xff;
+        int rc = mbedtls_aes_crypt_ecb(&key->aes, MBEDTLS_AES_ENCRYPT, padded, rpis[i].b);
+        if (rc) {
+            return rc;
+        }
+    }
+    return 0;
+}
+#endif
+
+int en_batch_derive_with_key(ENIntervalIdentifier* rpis,
+                             en_batch_key_t* key,
+                             ENIntervalNumber first,
+                             const ENIntervalNumber* intervals,
+                             size_t count) {
+#if EN_BATCH_AESNI
+    if (has_aesni()) {
+        derive_aesni(rpis, key, first, intervals, count);
+        return 0;
+    }
+#endif
+#if EN_BATCH_HOST
+    derive_bitsliced(rpis, key, first, intervals, count);
+    return 0;
+#else
+    return derive_mbedtls(rpis, key, first, intervals, count);
+#endif
+}
+
+static int derive(ENIntervalIdentifier* rpis,
+                  const ENPeriodIdentifierKey* pik,
+                  ENIntervalNumber first,
+                  const ENIntervalNumber* intervals,
+                  size_t count) {
+    en_batch_key_t key;
+    int rc = en_batch_key_setup(&key, pik);
+    if (rc) {
+        return rc;
+    }
+    rc = en_batch_derive_with_key(rpis, &key, first, intervals, count);
+    en_batch_key_clear(&key);
+    return rc;
+}
+
+int en_batch_derive_interval_identifiers(ENIntervalIdentifier* rpis,
+                                         const ENPeriodIdentifierKey* pik,
+                                         ENIntervalNumber first,
+                                         size_t count) {
+    return derive(rpis, pik, first, NULL, count);
+}
+
+int en_batch_derive_interval_identifiers_list(ENIntervalIdentifier* rpis,
+                                              const ENPeriodIdentifierKey* pik,
+                                              const ENIntervalNumber* intervals,
+                                              size_t count) {
+    return derive(rpis, pik, 0, intervals, count);
+}
@@ -0,0 +1,53 @@
+#include <string.h>
+#include <zephyr.h>
+#include <mbedtls/platform_util.h>
+
+#include "utility/en_key_cache.h"
+
+static en_key_context_t cache[CONFIG_ENS_KEY_CACHE_SIZE];
+static uint32_t use_counter;
+
+static void evict(en_key_context_t* entry) {
+    if (entry->last_used) {
+        en_batch_key_clear(&entry->rpi_key);
+    }
+    mbedtls_platform_zeroize(entry, sizeof(*entry));
+}
+
+en_key_context_t* en_key_cache_get(const ENPeriodKey* tek) {
+    en_key_context_t* lru = &cache[0];
+    for (int i = 0; i < CONFIG_ENS_KEY_CACHE_SIZE; i++) {
+        if (cache[i].last_used && memcmp(cache[i].tek.b, tek->b, sizeof(tek->b)) == 0) {
+            cache[i].last_used = ++use_counter;
+            return &cache[i];
+        }
+        if (cache[i].last_used < lru->last_used) {
+            lru = &cache[i];
+        }
+    }
+
+    evict(lru);
+    en_derive_period_identifier_key(&lru->pik, tek);
+    if (en_batch_key_setup(&lru->rpi_key, &lru->pik)) {
+        mbedtls_platform_zeroize(lru, sizeof(*lru));
+        return NULL;
+    }
+    memcpy(&lru->tek, tek, sizeof(lru->tek));
+    lru->last_used = ++use_counter;
+    return lru;
+}
+
+const ENPeriodMetadataEncryptionKey* en_key_cache_get_pmek(en_key_context_t* context) {
+    if (!context->has_pmek) {
+        en_derive_period_metadata_encryption_key(&context->pmek, &context->tek);
+        context->has_pmek = true;
+    }
+    return &context->pmek;
+}
+
+void en_key_cache_clear(void) {
+    for (int i = 0; i < CONFIG_ENS_KEY_CACHE_SIZE; i++) {
+        evict(&cache[i]);
+    }
+    use_counter = 0;
+}
@@ -15,6 +15,80 @@
 
 #define GET_CHECKSUM(x) (x & CRC_MASK)
 
+static int flush_staged(ens_fs_t* fs);
+
+static inline uint16_t get_entries_per_sector(ens_fs_t* fs) {
+    return fs->sector_size / fs->interal_size;
+}
+
+/**
+ * Check, if the data part of the given entry is all 1's.
+ */
+static bool is_erased(ens_fs_t* fs, const uint8_t* obj) {
+    for (int i = 0; i < fs->entry_size; i++) {
+        if ((obj[i] & 0xff) != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Find the first erased entry of the given sector via binary search, as the used entries of a sector form its prefix.
+ */
+static int init_sector_cursor(ens_fs_t* fs, uint16_t sector) {
+    uint64_t first_id = (uint64_t)sector * get_entries_per_sector(fs);
+    uint16_t lo = 0;
+    uint16_t hi = get_entries_per_sector(fs);
+
+    // most sectors are either completely used or completely erased, so check the last and first entry first
+    if (flash_area_read(fs->area, (first_id + hi - 1) * fs->interal_size, fs->buffer, fs->interal_size)) {
+        return -ENS_INTERR;
+    }
+    if (!is_erased(fs, fs->buffer)) {
+        lo = hi;
+    } else {
+        if (flash_area_read(fs->area, first_id * fs->interal_size, fs->buffer, fs->interal_size)) {
+            return -ENS_INTERR;
+        }
+        if (is_erased(fs, fs->buffer)) {
+            hi = 0;
+        }
+    }
+
+    while (lo < hi) {
+        uint16_t mid = lo + (hi - lo) / 2;
+        if (flash_area_read(fs->area, (first_id + mid) * fs->interal_size, fs->buffer, fs->interal_size)) {
+            return -ENS_INTERR;
+        }
+        if (is_erased(fs, fs->buffer)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    fs->sector_cursor[sector] = lo;
+    return 0;
+}
+
+/**
+ * Mark the given entry and all entries before it in its sector as in use.
+ */
+static inline void advance_cursor(ens_fs_t* fs, uint64_t id) {
+    uint16_t sector = id / get_entries_per_sector(fs);
+    uint16_t next = id % get_entries_per_sector(fs) + 1;
+    fs->sector_cursor[sector] = MAX(fs->sector_cursor[sector], next);
+}
+
+static inline bool is_in_use(ens_fs_t* fs, uint64_t id) {
+    return id % get_entries_per_sector(fs) < fs->sector_cursor[id / get_entries_per_sector(fs)];
+}
+
+static void flush_work_handler(struct k_work* work) {
+    ens_fs_t* fs = CONTAINER_OF(work, ens_fs_t, flush_work);
+    ens_fs_flush(fs);
+}
+
 int ens_fs_init(ens_fs_t* fs, uint8_t flash_id, uint64_t entry_size) {
     if (flash_area_open(flash_id, &fs->area)) {
         // opening of flash area was not successful
@@ -23,7 +97,6 @@ int ens_fs_init(ens_fs_t* fs, uint8_t flash_id, uint64_t entry_size) {
 
     // get all information needed for the needed for the fs
     const struct device* dev = flash_area_get_device(fs->area);
-    fs->sector_count = flash_get_page_count(dev);
     struct flash_pages_info info;
     if (flash_get_page_info_by_offs(dev, fs->area->fa_off, &info)) {
         // on error, close the flash area
@@ -31,6 +104,7 @@ int ens_fs_init(ens_fs_t* fs, uint8_t flash_id, uint64_t entry_size) {
         return -ENS_INTERR;
     }
     fs->sector_size = info.size;
+    fs->sector_count = fs->area->fa_size / info.size;
 
     // check, if needed internal size fits onto one page
     uint64_t internal_size = pow(2, ceil(log(entry_size + 1) / log(2)));
@@ -50,8 +124,45 @@ int ens_fs_init(ens_fs_t* fs, uint8_t flash_id, uint64_t entry_size) {
     memset(ptr, 0, internal_size);
     fs->buffer = ptr;
 
-    // init the lock for the fs
+    // allocate staging buffer for a whole program page
+    fs->page_size = MIN(CONFIG_ENS_FS_PAGE_SIZE, info.size);
+    if (fs->page_size % internal_size) {
+        k_free(fs->buffer);
+        flash_area_close(fs->area);
+        return -ENS_INVARG;
+    }
+    fs->page_buffer = k_malloc(fs->page_size);
+    if (fs->page_buffer == NULL) {
+        k_free(fs->buffer);
+        flash_area_close(fs->area);
+        return -ENS_INTERR;
+    }
+    fs->staged_start = 0;
+    fs->staged_count = 0;
+    fs->staged_limit = 0;
+    k_delayed_work_init(&fs->flush_work, flush_work_handler);
+
+    // init the write cursor of each sector
+    fs->sector_cursor = k_malloc(fs->sector_count * sizeof(*fs->sector_cursor));
+    if (fs->sector_cursor == NULL) {
+        k_free(fs->page_buffer);
+        k_free(fs->buffer);
+        flash_area_close(fs->area);
+        return -ENS_INTERR;
+    }
+    for (uint16_t sector = 0; sector < fs->sector_count; sector++) {
+        if (init_sector_cursor(fs, sector)) {
+            k_free(fs->sector_cursor);
+            k_free(fs->page_buffer);
+            k_free(fs->buffer);
+            flash_area_close(fs->area);
+            return -ENS_INTERR;
+        }
+    }
+
+    // init the locks for the fs
     k_mutex_init(&fs->ens_fs_lock);
+    k_mutex_init(&fs->erase_lock);
     return 0;
 }
 
@@ -59,6 +170,12 @@ int ens_fs_read(ens_fs_t* fs, uint64_t id, void* dest) {
     int rc = 0;
     k_mutex_lock(&fs->ens_fs_lock, K_FOREVER);
 
+    // staged entries are not in flash yet
+    if (fs->staged_count && id >= fs->staged_start && id < fs->staged_start + fs->staged_count) {
+        memcpy(dest, &fs->page_buffer[(id * fs->interal_size) % fs->page_size], fs->entry_size);
+        goto end;
+    }
+
     // read the entry from flash
     uint64_t offset = id * fs->interal_size;
     if (flash_area_read(fs->area, offset, fs->buffer, fs->interal_size)) {
@@ -100,32 +217,69 @@ end:
     return rc;
 }
 
+int ens_fs_read_range(ens_fs_t* fs, uint64_t id, size_t count, void* buffer) {
+    int rc = 0;
+    uint8_t* raw = buffer;
+    k_mutex_lock(&fs->ens_fs_lock, K_FOREVER);
+
+    if (flash_area_read(fs->area, id * fs->interal_size, raw, count * fs->interal_size)) {
+        rc = -ENS_INTERR;
+        goto end;
+    }
+
+    // staged entries are not in flash yet
+    uint64_t staged_end = fs->staged_start + fs->staged_count;
+    for (uint64_t i = MAX(id, fs->staged_start); i < MIN(id + count, staged_end); i++) {
+        memcpy(&raw[(i - id) * fs->interal_size], &fs->page_buffer[(i * fs->interal_size) % fs->page_size],
+               fs->interal_size);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        uint8_t* obj = &raw[i * fs->interal_size];
+
+        // check, if the entry is corrupted or deleted
+        uint8_t entryCRC = GET_CHECKSUM(obj[fs->entry_size]);
+        uint8_t checkCRC = crc7_be(SEED, obj, fs->entry_size);
+        int isNotDeleted = obj[fs->entry_size] & 1;
+        if (entryCRC != checkCRC || !isNotDeleted) {
+            continue;
+        }
+
+        // the destination is always before the current entry, so we never overwrite unchecked entries
+        memmove(&raw[rc * fs->entry_size], obj, fs->entry_size);
+        rc++;
+    }
+
+end:
+    k_mutex_unlock(&fs->ens_fs_lock);
+    return rc;
+}
+
 int ens_fs_write(ens_fs_t* fs, uint64_t id, void* data) {
     int rc = 0;
     uint64_t offset = id * fs->interal_size;
     uint8_t* obj = fs->buffer;
 
     k_mutex_lock(&fs->ens_fs_lock, K_FOREVER);
-    // read current data in flash...
-    if (flash_area_read(fs->area, offset, obj, fs->interal_size)) {
-        rc = -ENS_INTERR;
+    rc = flush_staged(fs);
+    if (rc) {
         goto end;
     }
-    // ...and check, if it's all 1's
-    for (int i = 0; i < fs->entry_size; i++) {
-        if ((obj[i] & 0xff) != 0xff) {
-            // if this entry is not all 1's, we return error and exit the function
-            rc = -ENS_ADDRINU;
-            goto end;
-        }
+    // check, if the entry is still erased
+    if (is_in_use(fs, id)) {
+        rc = -ENS_ADDRINU;
+        goto end;
     }
 
-    // copy data into interal buffer
-    memcpy(fs->buffer, data, fs->entry_size);
+    // copy data into interal buffer, unused bytes stay all 1's
+    memset(obj, 0xff, fs->interal_size);
+    memcpy(obj, data, fs->entry_size);
 
     // set CRC and not-deleted-flag
     obj[fs->entry_size] = crc7_be(SEED, obj, fs->entry_size) | 1;
 
+    // the entry is in use, even if writing fails
+    advance_cursor(fs, id);
     if (flash_area_write(fs->area, offset, obj, fs->interal_size)) {
         // writing to flash was not successful
         rc = -ENS_INTERR;
@@ -136,42 +290,154 @@ end:
     return rc;
 }
 
+static int flush_staged(ens_fs_t* fs) {
+    if (!fs->staged_count) {
+        return 0;
+    }
+
+    int rc = 0;
+    uint64_t offset = fs->staged_start * fs->interal_size;
+    if (flash_area_write(fs->area, offset, &fs->page_buffer[offset % fs->page_size],
+                         fs->staged_count * fs->interal_size)) {
+        // writing to flash was not successful, the staged entries are lost
+        rc = -ENS_INTERR;
+    }
+    fs->staged_count = 0;
+    fs->staged_limit = 0;
+    return rc;
+}
+
+int ens_fs_append(ens_fs_t* fs, uint64_t id, void* data) {
+    int rc = 0;
+    uint64_t offset = id * fs->interal_size;
+    size_t page_offset = offset % fs->page_size;
+
+    k_mutex_lock(&fs->ens_fs_lock, K_FOREVER);
+
+    // we can only combine consecutive entries
+    if (fs->staged_count && id != fs->staged_start + fs->staged_count) {
+        rc = flush_staged(fs);
+        if (rc) {
+            goto end;
+        }
+    }
+
+    if (!fs->staged_count) {
+        // the rest of the program page is erased, if our entry is
+        fs->staged_start = id;
+        fs->staged_limit = is_in_use(fs, id) ? 0 : (fs->page_size - page_offset) / fs->interal_size;
+    }
+
+    if (fs->staged_count >= fs->staged_limit) {
+        rc = -ENS_ADDRINU;
+        goto end;
+    }
+
+    // stage our entry with CRC and not-deleted-flag
+    uint8_t* obj = &fs->page_buffer[page_offset];
+    memset(obj, 0xff, fs->interal_size);
+    memcpy(obj, data, fs->entry_size);
+    obj[fs->entry_size] = crc7_be(SEED, obj, fs->entry_size) | 1;
+    fs->staged_count++;
+    advance_cursor(fs, id);
+
+    if (page_offset + fs->interal_size == fs->page_size) {
+        // our program page is full
+        rc = flush_staged(fs);
+    } else if (fs->staged_count == 1) {
+        k_delayed_work_submit(&fs->flush_work, K_MSEC(CONFIG_ENS_FS_FLUSH_TIMEOUT_MS));
+    }
+
+end:
+    k_mutex_unlock(&fs->ens_fs_lock);
+    return rc;
+}
+
+int ens_fs_flush(ens_fs_t* fs) {
+    k_mutex_lock(&fs->ens_fs_lock, K_FOREVER);
+    int rc = flush_staged(fs);
+    k_mutex_unlock(&fs->ens_fs_lock);
+    return rc;
+}
+
 int ens_fs_delete(ens_fs_t* fs, uint64_t id) {
     int rc = 0;
     k_mutex_lock(&fs->ens_fs_lock, K_FOREVER);
     uint64_t offset = id * fs->interal_size;
 
+    rc = flush_staged(fs);
+    if (rc) {
+        goto end;
+    }
+
     // set memory to 0, so not-deleted flag is 0
     memset(fs->buffer, 0, fs->interal_size);
+    advance_cursor(fs, id);
     if (flash_area_write(fs->area, offset, fs->buffer, fs->interal_size)) {
         // writing was not successful
         rc = -ENS_INTERR;
     }
 
+end:
     k_mutex_unlock(&fs->ens_fs_lock);
     return rc;
 }
 
-uint64_t ens_fs_make_space(ens_fs_t* fs, uint64_t entry_id) {
+/**
+ * Erase the sector starting at entry_id. The flash erase itself is done without holding ens_fs_lock, the sector is
+ * marked as completely in use in the meantime, so nobody writes to it.
+ */
+static int erase_sector(ens_fs_t* fs, uint64_t entry_id, bool only_if_full) {
     // calculate start and check, if it is at the start of a page
     uint64_t start = entry_id * fs->interal_size;
-    printk("requesting erase from byte %llu\n", start);
     if ((start % fs->sector_size) != 0) {
         return -ENS_INVARG;
     }
-    printk("Erasing from byte %llu\n", start);
 
     int rc = 0;
+    uint16_t sector = entry_id / get_entries_per_sector(fs);
+    k_mutex_lock(&fs->erase_lock, K_FOREVER);
+
     k_mutex_lock(&fs->ens_fs_lock, K_FOREVER);
+    flush_staged(fs);
+    uint16_t cursor = fs->sector_cursor[sector];
+    if (cursor == 0 || (only_if_full && cursor < get_entries_per_sector(fs))) {
+        // already erased (e.g. in the background) or written to in the meantime
+        k_mutex_unlock(&fs->ens_fs_lock);
+        goto end;
+    }
+    fs->sector_cursor[sector] = get_entries_per_sector(fs);
+    k_mutex_unlock(&fs->ens_fs_lock);
 
+    printk("Erasing from byte %llu\n", start);
     // erase given amount of pages, starting for the given offset
     if (flash_area_erase(fs->area, start, fs->sector_size)) {
         rc = -ENS_INTERR;
     } else {
         // if we are successful, return amount of deleted entries
-        rc = fs->sector_size / fs->interal_size;
+        k_mutex_lock(&fs->ens_fs_lock, K_FOREVER);
+        fs->sector_cursor[sector] = 0;
+        k_mutex_unlock(&fs->ens_fs_lock);
+        rc = get_entries_per_sector(fs);
     }
 
-    k_mutex_unlock(&fs->ens_fs_lock);
+end:
+    k_mutex_unlock(&fs->erase_lock);
     return rc;
 }
+
+uint64_t ens_fs_make_space(ens_fs_t* fs, uint64_t entry_id) {
+    printk("requesting erase from byte %llu\n", entry_id * fs->interal_size);
+    return erase_sector(fs, entry_id, false);
+}
+
+int ens_fs_pre_erase(ens_fs_t* fs, uint64_t entry_id) {
+    return erase_sector(fs, entry_id, true);
+}
+
+bool ens_fs_is_erased(ens_fs_t* fs, uint64_t id) {
+    k_mutex_lock(&fs->ens_fs_lock, K_FOREVER);
+    bool erased = !is_in_use(fs, id);
+    k_mutex_unlock(&fs->ens_fs_lock);
+    return erased;
+}
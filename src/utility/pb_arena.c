@@ -0,0 +1,35 @@
+#include <string.h>
+#include <zephyr.h>
+
+#include "utility/pb_arena.h"
+
+static void* arena_alloc(void* allocator_data, size_t size) {
+    pb_arena_t* arena = allocator_data;
+    size_t offset = ROUND_UP(arena->used, PB_ARENA_ALIGNMENT);
+    if (offset > arena->size || size > arena->size - offset) {
+        arena->failed++;
+        return NULL;
+    }
+
+    arena->last = offset;
+    arena->used = offset + size;
+    arena->high_water = MAX(arena->high_water, arena->used);
+    return &arena->buffer[offset];
+}
+
+static void arena_free(void* allocator_data, void* pointer) {
+    pb_arena_t* arena = allocator_data;
+    // only the latest allocation can be given back, everything else is freed on reset
+    if (pointer == &arena->buffer[arena->last]) {
+        arena->used = arena->last;
+    }
+}
+
+void pb_arena_init(pb_arena_t* arena, void* buffer, size_t size) {
+    memset(arena, 0, sizeof(*arena));
+    arena->allocator.alloc = arena_alloc;
+    arena->allocator.free = arena_free;
+    arena->allocator.allocator_data = arena;
+    arena->buffer = buffer;
+    arena->size = size;
+}
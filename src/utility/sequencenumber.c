@@ -27,6 +27,10 @@ record_sequence_number_t sn_increment_by(record_sequence_number_t sn, uint32_t a
     return GET_MASKED_SN((sn + amount));
 }
 
+uint32_t sn_distance(record_sequence_number_t older, record_sequence_number_t newer) {
+    return GET_MASKED_SN((newer - older));
+}
+
 record_sequence_number_t sn_get_middle_sn(record_sequence_number_t older, record_sequence_number_t newer) {
     if (older <= newer) {
         return GET_MASKED_SN(((older + newer) / 2));
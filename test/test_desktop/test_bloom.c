@@ -0,0 +1,137 @@
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// the desktop environment does not build the project sources
+#include "../../src/bloom.c"
+#include "../../src/fuse_filter.c"
+
+#define TEST_ENTRIES 65536
+#define TEST_PROBES (1 << 20)
+#define TEST_FALSE_POSITIVE_RATE 0.01f
+
+static void random_rpi(ENIntervalIdentifier* rpi) {
+    for (int i = 0; i < sizeof(rpi->b); i++) {
+        rpi->b[i] = rand();
+    }
+}
+
+static void fill_bloom(bloom_filter_t* bloom, int count) {
+    ENIntervalIdentifier rpi;
+    for (int i = 0; i < count; i++) {
+        random_rpi(&rpi);
+        bloom_add_record(bloom, &rpi);
+    }
+}
+
+static void check_added_records(bloom_filter_t* bloom) {
+    TEST_ASSERT_NOT_NULL(bloom);
+    srand(42);
+    fill_bloom(bloom, TEST_ENTRIES);
+    TEST_ASSERT_EQUAL(TEST_ENTRIES, bloom->count);
+
+    srand(42);
+    ENIntervalIdentifier rpi;
+    for (int i = 0; i < TEST_ENTRIES; i++) {
+        random_rpi(&rpi);
+        TEST_ASSERT_TRUE(bloom_probably_has_record(bloom, &rpi));
+    }
+    bloom_destroy(bloom);
+}
+
+/**
+ * Fill the filter with the expected amount of entries and measure false positive rate and lookup throughput.
+ */
+static float measure_fpr(bloom_filter_t* bloom, const char* name) {
+    fill_bloom(bloom, TEST_ENTRIES);
+
+    static ENIntervalIdentifier probes[TEST_PROBES];
+    for (int i = 0; i < TEST_PROBES; i++) {
+        random_rpi(&probes[i]);
+    }
+
+    uint32_t false_positives = 0;
+    clock_t start = clock();
+    for (int i = 0; i < TEST_PROBES; i++) {
+        false_positives += bloom_probably_has_record(bloom, &probes[i]);
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    float fpr = (float)false_positives / TEST_PROBES;
+    printf("%s: %u bytes, %u hashes, fpr %f (estimated %f), %.1f M probes/s\n", name, (uint32_t)bloom->size,
+           bloom->num_hashes, fpr, bloom_estimate_fpr(bloom), TEST_PROBES / seconds / 1000000);
+    bloom_destroy(bloom);
+    return fpr;
+}
+
+void test_bloom_has_added_records(void) {
+    check_added_records(bloom_init(TEST_ENTRIES, TEST_FALSE_POSITIVE_RATE));
+}
+
+void test_blocked_bloom_has_added_records(void) {
+    check_added_records(bloom_init_blocked(TEST_ENTRIES, TEST_FALSE_POSITIVE_RATE));
+}
+
+void test_bloom_false_positive_rate(void) {
+    bloom_filter_t* bloom = bloom_init(TEST_ENTRIES, TEST_FALSE_POSITIVE_RATE);
+    TEST_ASSERT_NOT_NULL(bloom);
+    float fpr = measure_fpr(bloom, "standard");
+    TEST_ASSERT_FLOAT_WITHIN(TEST_FALSE_POSITIVE_RATE / 4, TEST_FALSE_POSITIVE_RATE, fpr);
+}
+
+void test_blocked_bloom_false_positive_rate(void) {
+    bloom_filter_t* bloom = bloom_init_blocked(TEST_ENTRIES, TEST_FALSE_POSITIVE_RATE);
+    TEST_ASSERT_NOT_NULL(bloom);
+    float fpr = measure_fpr(bloom, "blocked");
+    TEST_ASSERT_FLOAT_WITHIN(TEST_FALSE_POSITIVE_RATE / 4, TEST_FALSE_POSITIVE_RATE, fpr);
+}
+
+void test_fuse_filter(void) {
+    static uint32_t keys[TEST_ENTRIES];
+    static uint32_t sorted_keys[TEST_ENTRIES];
+    ENIntervalIdentifier rpi;
+    // the fuse filter is limited to less keys
+    int count = FUSE_FILTER_MAX_KEYS;
+    for (int i = 0; i < count; i++) {
+        random_rpi(&rpi);
+        keys[i] = fuse_filter_key_from_rpi(&rpi);
+    }
+    // duplicates are allowed
+    keys[1] = keys[0];
+    memcpy(sorted_keys, keys, count * sizeof(uint32_t));
+
+    fuse_filter_t* fuse = fuse_filter_build(sorted_keys, count);
+    TEST_ASSERT_NOT_NULL(fuse);
+    TEST_ASSERT_EQUAL(fuse_filter_size(fuse->count), fuse->array_length);
+    for (int i = 0; i < count; i++) {
+        TEST_ASSERT_TRUE(fuse_filter_contains(fuse, keys[i]));
+    }
+
+    uint32_t false_positives = 0;
+    for (int i = 0; i < TEST_PROBES; i++) {
+        random_rpi(&rpi);
+        false_positives += fuse_filter_contains(fuse, fuse_filter_key_from_rpi(&rpi));
+    }
+    float fpr = (float)false_positives / TEST_PROBES;
+    printf("fuse: %u bytes, fpr %f\n", fuse->array_length, fpr);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 1.0f / 256, fpr);
+    fuse_filter_destroy(fuse);
+}
+
+void test_empty_fuse_filter(void) {
+    fuse_filter_t* fuse = fuse_filter_build(NULL, 0);
+    TEST_ASSERT_NOT_NULL(fuse);
+    TEST_ASSERT_FALSE(fuse_filter_contains(fuse, 42));
+    fuse_filter_destroy(fuse);
+}
+
+void test_bloom(void) {
+    RUN_TEST(test_bloom_has_added_records);
+    RUN_TEST(test_blocked_bloom_has_added_records);
+    RUN_TEST(test_bloom_false_positive_rate);
+    RUN_TEST(test_blocked_bloom_false_positive_rate);
+    RUN_TEST(test_fuse_filter);
+    RUN_TEST(test_empty_fuse_filter);
+}
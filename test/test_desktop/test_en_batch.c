@@ -0,0 +1,71 @@
+#include <unity.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../src/utility/en_batch.c"
+
+#define TEST_FIRST_INTERVAL 2642976
+#define TEST_INTERVALS 200  // more than a single batch of each kernel
+
+static void random_pik(ENPeriodIdentifierKey* pik) {
+    for (int i = 0; i < sizeof(pik->b); i++) {
+        pik->b[i] = rand();
+    }
+}
+
+/**
+ * Check the identifiers of a kernel against the reference implementation.
+ */
+static void check_kernel(void (*expand_key)(en_batch_key_t*, const ENPeriodIdentifierKey*),
+                         void (*kernel)(ENIntervalIdentifier*,
+                                        const en_batch_key_t*,
+                                        ENIntervalNumber,
+                                        const ENIntervalNumber*,
+                                        size_t)) {
+    static ENIntervalIdentifier rpis[TEST_INTERVALS];
+    static ENIntervalNumber intervals[TEST_INTERVALS];
+    ENIntervalIdentifier expected;
+    ENPeriodIdentifierKey pik;
+    en_batch_key_t key;
+
+    for (int run = 0; run < 10; run++) {
+        random_pik(&pik);
+        expand_key(&key, &pik);
+        kernel(rpis, &key, TEST_FIRST_INTERVAL, NULL, TEST_INTERVALS);
+        for (int i = 0; i < TEST_INTERVALS; i++) {
+            en_derive_interval_identifier(&expected, &pik, TEST_FIRST_INTERVAL + i);
+            TEST_ASSERT_EQUAL_MEMORY(expected.b, rpis[i].b, sizeof(expected.b));
+        }
+
+        for (int i = 0; i < TEST_INTERVALS; i++) {
+            intervals[i] = rand();
+        }
+        // an odd amount leaves some lanes unused
+        kernel(rpis, &key, 0, intervals, TEST_INTERVALS - 1);
+        for (int i = 0; i < TEST_INTERVALS - 1; i++) {
+            en_derive_interval_identifier(&expected, &pik, intervals[i]);
+            TEST_ASSERT_EQUAL_MEMORY(expected.b, rpis[i].b, sizeof(expected.b));
+        }
+    }
+}
+
+void test_bitsliced_rpis(void) {
+    check_kernel(expand_key_bitsliced, derive_bitsliced);
+}
+
+void test_aesni_rpis(void) {
+#if EN_BATCH_AESNI
+    if (!has_aesni()) {
+        TEST_IGNORE_MESSAGE("CPU without AES-NI");
+    }
+    check_kernel(expand_key_aesni, derive_aesni);
+#else
+    TEST_IGNORE_MESSAGE("AES-NI not available on this host");
+#endif
+}
+
+void test_en_batch(void) {
+    RUN_TEST(test_bitsliced_rpis);
+    RUN_TEST(test_aesni_rpis);
+}
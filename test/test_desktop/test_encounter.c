@@ -0,0 +1,118 @@
+#include <unity.h>
+
+#include <string.h>
+
+// the record type pulls in the record storage header, which needs its Kconfig options
+#define CONFIG_ENS_RECORD_ITERATOR_BUFFER_SIZE 1
+#define CONFIG_ENS_ENCOUNTER_TABLE_SIZE 64
+#define CONFIG_ENS_ENCOUNTER_TIMEOUT 600
+#define CONFIG_ENS_ENCOUNTER_MAX_DURATION 1800
+#include "../../src/encounter.c"
+
+#define TEST_START 1608000000
+#define TEST_DURATION (6 * 3600)
+#define TEST_SIGHTING_INTERVAL 10
+#define TEST_DEVICES 16
+#define TEST_MAX_RECORDS 1024
+
+// the records in the order they were appended, with the time they were appended at
+static record_t appended[TEST_MAX_RECORDS];
+static uint32_t appended_at[TEST_MAX_RECORDS];
+static int appended_count;
+static uint32_t now;
+
+int add_record(record_t* record) {
+    TEST_ASSERT_LESS_THAN(TEST_MAX_RECORDS, appended_count);
+    appended[appended_count] = *record;
+    appended[appended_count].sn = appended_count;
+    appended_at[appended_count] = now;
+    appended_count++;
+    return 0;
+}
+
+/**
+ * Let the devices come and go, device 0 stays all the time and never changes its identifier.
+ */
+static void simulate_sightings() {
+    appended_count = 0;
+    for (now = TEST_START; now < TEST_START + TEST_DURATION; now += TEST_SIGHTING_INTERVAL) {
+        for (uint32_t device = 0; device < TEST_DEVICES; device++) {
+            uint32_t elapsed = now - TEST_START;
+            // other devices are in range for device * 5 minutes of each hour and rotate every 15 minutes
+            if (device > 0 && elapsed % 3600 >= device * 300) {
+                continue;
+            }
+            uint32_t rotation = device > 0 ? elapsed / 900 : 0;
+            record_t sighting;
+            memset(&sighting, 0, sizeof(sighting));
+            memcpy(&sighting.rolling_proximity_identifier.b[0], &device, sizeof(device));
+            memcpy(&sighting.rolling_proximity_identifier.b[4], &rotation, sizeof(rotation));
+            sighting.timestamp = now;
+            sighting.rssi = (uint8_t)-60;
+            encounter_add_sighting(&sighting);
+        }
+        // like the contact storage thread
+        if ((now - TEST_START) % (CONFIG_ENS_ENCOUNTER_TIMEOUT / 2) == 0) {
+            encounter_flush_expired(now);
+        }
+    }
+    encounter_flush_all();
+}
+
+void test_encounter_append_delay(void) {
+    simulate_sightings();
+    TEST_ASSERT_GREATER_THAN(TEST_DEVICES, appended_count);
+
+    bool out_of_order = false;
+    uint32_t newest = 0;
+    for (int i = 0; i < appended_count; i++) {
+        uint32_t ts = appended[i].timestamp;
+        TEST_ASSERT_LESS_OR_EQUAL(RECORD_MAX_APPEND_DELAY, appended_at[i] - ts);
+        TEST_ASSERT_LESS_THAN(CONFIG_ENS_ENCOUNTER_MAX_DURATION, appended[i].duration * 60);
+        // the timerange searches rely on this
+        TEST_ASSERT_LESS_OR_EQUAL(ts + RECORD_MAX_APPEND_DELAY, newest);
+        out_of_order |= ts < newest;
+        newest = MAX(newest, ts);
+    }
+    TEST_ASSERT_TRUE(out_of_order);
+}
+
+/**
+ * Index of the first record with at least (min) or the last one with at most (max) the target timestamp, by binary
+ * search like the record storage does. Assumes sorted timestamps.
+ */
+static int search(uint32_t target, bool min) {
+    int lo = -1;
+    int hi = appended_count;
+    while (hi - lo > 1) {
+        int mid = lo + (hi - lo) / 2;
+        if (appended[mid].timestamp < target || (!min && appended[mid].timestamp == target)) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return min ? hi : lo;
+}
+
+void test_encounter_timerange_search(void) {
+    simulate_sightings();
+
+    // the widened search finds all records of a range, although they were appended out of order
+    for (uint32_t start = TEST_START; start < TEST_START + TEST_DURATION; start += 450) {
+        uint32_t end = start + 900;
+        int first = search(start - RECORD_MAX_APPEND_DELAY, true);
+        int last = search(end + RECORD_MAX_APPEND_DELAY, false);
+        for (int i = 0; i < appended_count; i++) {
+            if (appended[i].timestamp >= start && appended[i].timestamp <= end) {
+                TEST_ASSERT_GREATER_OR_EQUAL(first, i);
+                TEST_ASSERT_LESS_OR_EQUAL(last, i);
+            }
+        }
+    }
+}
+
+void test_encounter(void) {
+    RUN_TEST(test_encounter_append_delay);
+    RUN_TEST(test_encounter_timerange_search);
+}
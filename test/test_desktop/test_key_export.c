@@ -0,0 +1,262 @@
+#include <unity.h>
+
+#include <errno.h>
+#include <string.h>
+
+// the exposure key type pulls in the record storage header, which needs its Kconfig options
+#define CONFIG_ENS_RECORD_ITERATOR_BUFFER_SIZE 1
+#include "../../src/key_export.c"
+// pb_arena.c is part of test_pb_arena.c, protobuf-c is built as library
+#include "../../src/export.pb-c.c"
+
+#define TEST_KEYS 50
+
+static exposure_key_t decoded[TEST_KEYS];
+static int decoded_count;
+
+static int on_key(const exposure_key_t* key, void* userdata) {
+    if (decoded_count < TEST_KEYS) {
+        decoded[decoded_count] = *key;
+    }
+    decoded_count++;
+    return 0;
+}
+
+static size_t put_varint(uint8_t* buf, uint64_t value) {
+    size_t size = 0;
+    do {
+        buf[size++] = (value & 0x7f) | (value >= 0x80 ? 0x80 : 0);
+        value >>= 7;
+    } while (value);
+    return size;
+}
+
+static size_t put_tag(uint8_t* buf, uint32_t field, uint8_t wire_type) {
+    return put_varint(buf, (field << 3) | wire_type);
+}
+
+static size_t put_key(uint8_t* buf, uint32_t i) {
+    uint8_t message[KEY_EXPORT_MAX_KEY_SIZE];
+    size_t size = put_tag(message, KEY_FIELD_KEY_DATA, WIRE_LENGTH_DELIMITED);
+    size += put_varint(&message[size], sizeof(ENPeriodKey));
+    memset(&message[size], i, sizeof(ENPeriodKey));
+    size += sizeof(ENPeriodKey);
+    size += put_tag(&message[size], 2, WIRE_VARINT);  // transmission_risk_level
+    size += put_varint(&message[size], 4);
+    size += put_tag(&message[size], KEY_FIELD_ROLLING_START_INTERVAL_NUMBER, WIRE_VARINT);
+    size += put_varint(&message[size], 2642976 + i * EN_TEK_ROLLING_PERIOD);
+    if (i % 2) {
+        size += put_tag(&message[size], KEY_FIELD_ROLLING_PERIOD, WIRE_VARINT);
+        size += put_varint(&message[size], i);
+    }
+
+    size_t total = put_tag(buf, EXPORT_FIELD_KEYS, WIRE_LENGTH_DELIMITED);
+    total += put_varint(&buf[total], size);
+    memcpy(&buf[total], message, size);
+    return total + size;
+}
+
+/**
+ * Serialize an export with some fields around the keys, which have to be skipped.
+ */
+static size_t build_export(uint8_t* buf) {
+    size_t size = KEY_EXPORT_HEADER_SIZE;
+    memcpy(buf, KEY_EXPORT_HEADER, KEY_EXPORT_HEADER_SIZE);
+    size += put_tag(&buf[size], 1, WIRE_FIXED64);  // start_timestamp
+    memset(&buf[size], 0xab, 8);
+    size += 8;
+    size += put_tag(&buf[size], 3, WIRE_LENGTH_DELIMITED);  // region
+    size += put_varint(&buf[size], 3);
+    memcpy(&buf[size], "DEU", 3);
+    size += 3;
+    size += put_tag(&buf[size], 4, WIRE_VARINT);  // batch_num
+    size += put_varint(&buf[size], 1);
+    for (int i = 0; i < TEST_KEYS; i++) {
+        size += put_key(&buf[size], i);
+    }
+    size += put_tag(&buf[size], 6, WIRE_LENGTH_DELIMITED);  // signature_infos
+    size += put_varint(&buf[size], 200);
+    memset(&buf[size], 0x12, 200);
+    size += 200;
+    return size;
+}
+
+static void check_decoded(void) {
+    TEST_ASSERT_EQUAL(TEST_KEYS, decoded_count);
+    for (int i = 0; i < TEST_KEYS; i++) {
+        TEST_ASSERT_EQUAL(i, decoded[i].key.b[0]);
+        TEST_ASSERT_EQUAL(i, decoded[i].key.b[15]);
+        TEST_ASSERT_EQUAL(2642976 + i * EN_TEK_ROLLING_PERIOD, decoded[i].rolling_start_interval_number);
+        TEST_ASSERT_EQUAL(i % 2 ? i : 0, decoded[i].rolling_period);
+    }
+}
+
+void test_key_export_chunks(void) {
+    static uint8_t buf[4096];
+    size_t size = build_export(buf);
+    key_export_decoder_t decoder;
+
+    // the whole file at once and byte by byte
+    for (size_t chunk = size; chunk > 0; chunk = chunk == size ? 1 : 0) {
+        decoded_count = 0;
+        key_export_decoder_init(&decoder, on_key, NULL);
+        for (size_t pos = 0; pos < size; pos += chunk) {
+            TEST_ASSERT_EQUAL(0, key_export_decoder_feed(&decoder, &buf[pos], MIN(chunk, size - pos)));
+        }
+        TEST_ASSERT_EQUAL(0, key_export_decoder_finish(&decoder));
+        TEST_ASSERT_EQUAL(0, decoder.invalid_keys);
+        // only keys split over chunks are buffered
+        TEST_ASSERT_EQUAL(chunk == size ? 0 : TEST_KEYS, decoder.copied_keys);
+        check_decoded();
+    }
+}
+
+void test_key_export_invalid(void) {
+    static uint8_t buf[4096];
+    size_t size = build_export(buf);
+    key_export_decoder_t decoder;
+
+    // truncated within a key
+    key_export_decoder_init(&decoder, on_key, NULL);
+    TEST_ASSERT_EQUAL(0, key_export_decoder_feed(&decoder, buf, 100));
+    TEST_ASSERT_EQUAL(-EINVAL, key_export_decoder_finish(&decoder));
+
+    // wrong header
+    buf[0] = 'X';
+    key_export_decoder_init(&decoder, on_key, NULL);
+    TEST_ASSERT_EQUAL(-EINVAL, key_export_decoder_feed(&decoder, buf, size));
+}
+
+void test_key_export_parse_in_place(void) {
+    uint8_t buf[KEY_EXPORT_MAX_KEY_SIZE + 2];
+    size_t size = put_key(buf, 3);
+    const uint8_t* message = &buf[2];  // skip tag and length of the keys field
+    key_export_key_view_t view;
+
+    TEST_ASSERT_EQUAL(0, key_export_parse_key(message, size - 2, &view));
+    TEST_ASSERT_EQUAL_PTR(&message[2], view.key_data);
+    TEST_ASSERT_EQUAL(2642976 + 3 * EN_TEK_ROLLING_PERIOD, view.rolling_start_interval_number);
+    TEST_ASSERT_EQUAL(3, view.rolling_period);
+
+    // without key data
+    TEST_ASSERT_EQUAL(-EINVAL, key_export_parse_key(&message[18], size - 20, &view));
+}
+
+void test_key_export_protobuf_fallback(void) {
+    uint8_t key_data[16];
+    memset(key_data, 7, sizeof(key_data));
+    TemporaryExposureKey message = TEMPORARY_EXPOSURE_KEY__INIT;
+    message.has_key_data = 1;
+    message.key_data.data = key_data;
+    message.key_data.len = sizeof(key_data);
+    message.has_rolling_start_interval_number = 1;
+    message.rolling_start_interval_number = 2642976;
+    message.has_report_type = 1;
+    message.report_type = TEMPORARY_EXPOSURE_KEY__REPORT_TYPE__CONFIRMED_TEST;
+    message.has_days_since_onset_of_symptoms = 1;
+    message.days_since_onset_of_symptoms = -2;
+
+    uint8_t buf[KEY_EXPORT_MAX_KEY_SIZE];
+    size_t size = temporary_exposure_key__pack(&message, buf);
+    key_export_key_view_t view;
+    exposure_key_t fast;
+    exposure_key_t generic;
+
+    // the fields of the schema are understood
+    TEST_ASSERT_EQUAL(0, key_export_parse_key(buf, size, &view));
+    TEST_ASSERT_EQUAL(0, key_export_unpack_key(buf, size, &fast));
+    TEST_ASSERT_EQUAL(0, key_export_unpack_key_protobuf(buf, size, &generic));
+    TEST_ASSERT_EQUAL_MEMORY(&generic, &fast, sizeof(fast));
+    TEST_ASSERT_EQUAL(0, fast.rolling_period);
+
+    // an unknown field is left to protobuf-c, which skips it
+    buf[size++] = KEY_TAG(9, WIRE_FIXED32);
+    memset(&buf[size], 0, 4);
+    size += 4;
+    TEST_ASSERT_EQUAL(-ENOTSUP, key_export_parse_key(buf, size, &view));
+    TEST_ASSERT_EQUAL(0, key_export_unpack_key(buf, size, &fast));
+    TEST_ASSERT_EQUAL_MEMORY(&generic, &fast, sizeof(fast));
+
+    // so is key data of the wrong size, which protobuf-c rejects
+    message.key_data.len = 15;
+    size = temporary_exposure_key__pack(&message, buf);
+    TEST_ASSERT_EQUAL(-ENOTSUP, key_export_parse_key(buf, size, &view));
+    TEST_ASSERT_EQUAL(-EINVAL, key_export_unpack_key(buf, size, &fast));
+}
+
+/**
+ * An export with all fields of the schema, serialized by the reference encoder from full_export.txtpb:
+ * protoc -I../../src --encode=TemporaryExposureKeyExport export.proto < full_export.txtpb
+ */
+static const uint8_t full_export[] = {
+    0x09, 0x00, 0x4e, 0xd9, 0x5f, 0x00, 0x00, 0x00, 0x00, 0x11, 0x80, 0x9f,
+    0xda, 0x5f, 0x00, 0x00, 0x00, 0x00, 0x1a, 0x03, 0x44, 0x45, 0x55, 0x20,
+    0x01, 0x28, 0x02, 0x32, 0x1e, 0x1a, 0x02, 0x76, 0x31, 0x22, 0x03, 0x32,
+    0x36, 0x32, 0x2a, 0x13, 0x31, 0x2e, 0x32, 0x2e, 0x38, 0x34, 0x30, 0x2e,
+    0x31, 0x30, 0x30, 0x34, 0x35, 0x2e, 0x34, 0x2e, 0x33, 0x2e, 0x32, 0x3a,
+    0x20, 0x0a, 0x10, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09,
+    0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x10, 0x04, 0x18, 0xc0, 0xca,
+    0xa3, 0x01, 0x20, 0x90, 0x01, 0x28, 0x01, 0x30, 0x05, 0x3a, 0x19, 0x0a,
+    0x10, 0xff, 0xfe, 0xfd, 0xfc, 0xfb, 0xfa, 0xf9, 0xf8, 0xf7, 0xf6, 0xf5,
+    0xf4, 0xf3, 0xf2, 0xf1, 0xf0, 0x18, 0xd0, 0xcb, 0xa3, 0x01, 0x20, 0x48,
+    0x42, 0x19, 0x0a, 0x10, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+    0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x18, 0xc0, 0xca, 0xa3,
+    0x01, 0x28, 0x05,
+};
+
+void test_key_export_protobuf_schema(void) {
+    TemporaryExposureKeyExport* message = temporary_exposure_key_export__unpack(NULL, sizeof(full_export), full_export);
+    TEST_ASSERT_NOT_NULL(message);
+
+    TEST_ASSERT_TRUE(message->has_start_timestamp);
+    TEST_ASSERT_EQUAL(1608076800, message->start_timestamp);
+    TEST_ASSERT_TRUE(message->has_end_timestamp);
+    TEST_ASSERT_EQUAL(1608163200, message->end_timestamp);
+    TEST_ASSERT_EQUAL_STRING("DEU", message->region);
+    TEST_ASSERT_EQUAL(1, message->batch_num);
+    TEST_ASSERT_EQUAL(2, message->batch_size);
+
+    TEST_ASSERT_EQUAL(1, message->n_signature_infos);
+    TEST_ASSERT_EQUAL_STRING("v1", message->signature_infos[0]->verification_key_version);
+    TEST_ASSERT_EQUAL_STRING("262", message->signature_infos[0]->verification_key_id);
+    TEST_ASSERT_EQUAL_STRING("1.2.840.10045.4.3.2", message->signature_infos[0]->signature_algorithm);
+
+    TEST_ASSERT_EQUAL(2, message->n_keys);
+    TemporaryExposureKey* key = message->keys[0];
+    TEST_ASSERT_EQUAL(16, key->key_data.len);
+    TEST_ASSERT_EQUAL(1, key->key_data.data[0]);
+    TEST_ASSERT_EQUAL(16, key->key_data.data[15]);
+    TEST_ASSERT_EQUAL(4, key->transmission_risk_level);
+    TEST_ASSERT_EQUAL(2680128, key->rolling_start_interval_number);
+    TEST_ASSERT_EQUAL(144, key->rolling_period);
+    TEST_ASSERT_EQUAL(TEMPORARY_EXPOSURE_KEY__REPORT_TYPE__CONFIRMED_TEST, key->report_type);
+    TEST_ASSERT_EQUAL(-3, key->days_since_onset_of_symptoms);
+    key = message->keys[1];
+    TEST_ASSERT_EQUAL(0xff, key->key_data.data[0]);
+    TEST_ASSERT_EQUAL(2680272, key->rolling_start_interval_number);
+    TEST_ASSERT_EQUAL(72, key->rolling_period);
+    TEST_ASSERT_FALSE(key->has_report_type);
+    TEST_ASSERT_FALSE(key->has_days_since_onset_of_symptoms);
+
+    TEST_ASSERT_EQUAL(1, message->n_revised_keys);
+    key = message->revised_keys[0];
+    TEST_ASSERT_FALSE(key->has_rolling_period);
+    TEST_ASSERT_EQUAL(EN_TEK_ROLLING_PERIOD, key->rolling_period);  // the default of the schema
+    TEST_ASSERT_EQUAL(TEMPORARY_EXPOSURE_KEY__REPORT_TYPE__REVOKED, key->report_type);
+
+    // packed again, it matches the reference encoder byte by byte
+    uint8_t buf[sizeof(full_export)];
+    TEST_ASSERT_EQUAL(sizeof(full_export), temporary_exposure_key_export__get_packed_size(message));
+    TEST_ASSERT_EQUAL(sizeof(full_export), temporary_exposure_key_export__pack(message, buf));
+    TEST_ASSERT_EQUAL_MEMORY(full_export, buf, sizeof(full_export));
+
+    temporary_exposure_key_export__free_unpacked(message, NULL);
+}
+
+void test_key_export(void) {
+    RUN_TEST(test_key_export_chunks);
+    RUN_TEST(test_key_export_invalid);
+    RUN_TEST(test_key_export_parse_in_place);
+    RUN_TEST(test_key_export_protobuf_fallback);
+    RUN_TEST(test_key_export_protobuf_schema);
+}
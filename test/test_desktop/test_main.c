@@ -0,0 +1,20 @@
+#include <unity.h>
+
+// each test file runs its own tests
+void test_bloom(void);
+void test_en_batch(void);
+void test_encounter(void);
+void test_key_export(void);
+void test_pb_arena(void);
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    test_bloom();
+    test_en_batch();
+    test_encounter();
+    test_key_export();
+    test_pb_arena();
+    UNITY_END();
+
+    return 0;
+}
@@ -0,0 +1,31 @@
+#include <unity.h>
+
+#include "../../src/utility/pb_arena.c"
+
+void test_pb_arena_alloc_and_reset(void) {
+    static uint64_t buffer[16];
+    pb_arena_t arena;
+    pb_arena_init(&arena, buffer, sizeof(buffer));
+    ProtobufCAllocator* allocator = &arena.allocator;
+
+    uint8_t* a = allocator->alloc(allocator->allocator_data, 3);
+    uint8_t* b = allocator->alloc(allocator->allocator_data, 20);
+    TEST_ASSERT_EQUAL((uint8_t*)buffer, a);
+    TEST_ASSERT_EQUAL(a + PB_ARENA_ALIGNMENT, b);
+
+    // the latest allocation is given back, older ones are kept until the reset
+    allocator->free(allocator->allocator_data, b);
+    allocator->free(allocator->allocator_data, a);
+    TEST_ASSERT_EQUAL(b, allocator->alloc(allocator->allocator_data, 8));
+
+    TEST_ASSERT_NULL(allocator->alloc(allocator->allocator_data, sizeof(buffer)));
+    TEST_ASSERT_EQUAL(1, arena.failed);
+
+    pb_arena_reset(&arena);
+    TEST_ASSERT_EQUAL(a, allocator->alloc(allocator->allocator_data, sizeof(buffer)));
+    TEST_ASSERT_EQUAL(sizeof(buffer), arena.high_water);
+}
+
+void test_pb_arena(void) {
+    RUN_TEST(test_pb_arena_alloc_and_reset);
+}
@@ -0,0 +1,22 @@
+#!/bin/bash
+# Regenerates export.pb-c.c and export.pb-c.h from src/export.proto, needs protoc and the protoc-c plugin of
+# protobuf-c 1.4 (protoc-gen-c), which matches the runtime in lib/protobuf-c.
+
+set -e
+cd "$(dirname "$0")/.."
+
+if ! command -v protoc-gen-c > /dev/null && ! command -v protoc-c > /dev/null; then
+    echo "protoc-gen-c not found, install protobuf-c-compiler"
+    exit 1
+fi
+
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+if command -v protoc-c > /dev/null; then
+    protoc-c -Isrc --c_out="$out" src/export.proto
+else
+    protoc -Isrc --c_out="$out" src/export.proto
+fi
+mv "$out/export.pb-c.c" src/export.pb-c.c
+mv "$out/export.pb-c.h" include/export.pb-c.h
+echo "Generated src/export.pb-c.c and include/export.pb-c.h"